@@ -702,10 +702,12 @@ namespace Wasmc {
 		QueryType type;
 
 		WASMQueryNode(QueryType, ASTNode *rd_);
+		WASMQueryNode(QueryType, ASTNode *rs_, ASTNode *rd_);
 		WASMQueryNode(QueryType, const std::string *rd_);
+		WASMQueryNode(QueryType, const std::string *rs_, const std::string *rd_);
 		Opcode getOpcode() const override { return OPCODES.at("qm"); } // All query types share the same opcode
 		Funct getFunct() const override;
-		WASMInstructionNode * copy() const override { return (new WASMQueryNode(type, rd))->absorb(*this); }
+		WASMInstructionNode * copy() const override { return (new WASMQueryNode(type, rs, rd))->absorb(*this); }
 		WASMNodeType nodeType() const override { return WASMNodeType::Query; }
 		std::string debugExtra() const override;
 		operator std::string() const override;
@@ -2,5 +2,5 @@
 
 namespace Wasmc {
 	std::unordered_map<QueryType, std::string> query_map {
-		{QueryType::Memory, "mem"}};
+		{QueryType::Memory, "mem"}, {QueryType::Counter, "ctr"}};
 }
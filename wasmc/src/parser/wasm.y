@@ -124,6 +124,7 @@ using AN = Wasmc::ASTNode;
 %token WASMTOK_SHORT "/s"
 %token WASMTOK_QUESTION "?"
 %token WASMTOK_MEM "mem"
+%token WASMTOK_CTR "ctr"
 %token WASMTOK_P "p"
 %token WASMTOK_REG
 %token WASMTOK_NUMBER
@@ -266,7 +267,7 @@ operation: op_r    | op_mult  | op_multi | op_lui    | op_i      | op_c      | o
          | op_li   | op_si    | op_ms    | op_lni    | op_ch     | op_lh     | op_sh     | op_cmp  | op_cmpi  | op_sel
          | op_j    | op_jc    | op_jr    | op_jrc    | op_mv     | op_spush  | op_spop   | op_nop  | op_int   | op_rit
          | op_time | op_timei | op_ext   | op_ringi  | op_sspush | op_sspop  | op_ring   | op_page | op_setpt | op_svpg
-         | op_qmem | op_ret   | op_jeq   | op_sprint | op_inc    | op_dec    | op_cs     | op_ls   | op_ss    | op_di
+         | op_qmem | op_qctr  | op_ret   | op_jeq   | op_sprint | op_inc    | op_dec    | op_cs     | op_ls   | op_ss    | op_di
          | op_ei   | op_inv   | op_trans | op_ppush  | op_ppop   | op_svring | op_svtime | op_ctlb | op_sps   | op_spl;
 
 label: "@" ident          { $$ = new WASMLabelNode($2); D($1); }
@@ -428,6 +429,7 @@ op_ppop:     "]" "%page"     { $$ = new WASMPageStackNode(false);     D($1, $2);
        | ":" "]" "%page" reg { $$ = new WASMPageStackNode(false, $4); D($1, $2, $3); };
 
 op_qmem: "?" "mem" "->" reg { $$ = new WASMQueryNode(QueryType::Memory, $4); D($1, $2, $3); };
+op_qctr: "?" "ctr" reg "->" reg { $$ = new WASMQueryNode(QueryType::Counter, $3, $5); D($1, $2, $4); };
 
 op_ret: "!ret" { $$ = new WASMJrNode(Condition::None, false, "$rt"); D($1); };
 
@@ -441,7 +443,7 @@ _immediate: "&" ident { $$ = $2; D($1); }
 
 ident: ident_option { $1->symbol = WASMTOK_IDENT; } | WASMTOK_IDENT;
 ident_option: "memset" | "lui" | "if" | "halt" | "on" | "off" | "sleep" | "io" | symbol_type | "version" | "author"
-            | "orcid" | "name" | "sext32" | printop | "translate";
+            | "orcid" | "name" | "sext32" | printop | "translate" | "ctr";
 
 zero: number { if (*$1->lexerInfo != "0") { wasmerror("Invalid number in jump condition: " + *$1->lexerInfo); } };
 
@@ -196,6 +196,7 @@ namespace Wasmc {
 		{"srlii",  OP_SRLII },
 		{"sraii",  OP_SRAII },
 		{"qm",     OP_QM    },
+		{"qc",     OP_QC    },
 		{"ei",     OP_EI    },
 		{"di",     OP_DI    },
 		{"modui",  OP_MODUI },
@@ -295,6 +296,7 @@ namespace Wasmc {
 		{"pgon",   0b000000000001},
 		{"printr", 0b000000000001},
 		{"ei",     0b000000000001},
+		{"qc",     0b000000000001},
 		{"svring", 0b000000000001},
 		{"svtime", 0b000000000001},
 		{"jrl",    0b000000000010},
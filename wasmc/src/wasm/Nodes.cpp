@@ -1161,21 +1161,36 @@ namespace Wasmc {
 		delete rd_;
 	}
 
+	WASMQueryNode::WASMQueryNode(QueryType type_, ASTNode *rs_, ASTNode *rd_):
+	WASMInstructionNode(WASM_QUERYNODE), RType(rs_, nullptr, rd_), type(type_) {
+		delete rs_;
+		delete rd_;
+	}
+
 	WASMQueryNode::WASMQueryNode(QueryType type_, const std::string *rd_):
 		WASMInstructionNode(WASM_QUERYNODE), RType(nullptr, nullptr, rd_), type(type_) {}
 
+	WASMQueryNode::WASMQueryNode(QueryType type_, const std::string *rs_, const std::string *rd_):
+		WASMInstructionNode(WASM_QUERYNODE), RType(rs_, nullptr, rd_), type(type_) {}
+
 	Funct WASMQueryNode::getFunct() const {
 		switch (type) {
-			case QueryType::Memory: return FUNCTS.at("qm");
+			case QueryType::Memory:  return FUNCTS.at("qm");
+			case QueryType::Counter: return FUNCTS.at("qc");
 			default: throw std::runtime_error("Invalid query type: " + std::to_string(static_cast<int>(type)));
 		}
 	}
 
 	std::string WASMQueryNode::debugExtra() const {
+		if (type == QueryType::Counter)
+			return WASMInstructionNode::debugExtra() + "? " + blue(query_map.at(type)) + " " + cyan(*rs) + dim(" -> ") +
+				cyan(*rd);
 		return WASMInstructionNode::debugExtra() + "? " + blue(query_map.at(type)) + dim(" -> ") + cyan(*rd);
 	}
 
 	WASMQueryNode::operator std::string() const {
+		if (type == QueryType::Counter)
+			return WASMInstructionNode::operator std::string() + "? ctr " + *rs + " -> " + *rd;
 		return WASMInstructionNode::operator std::string() + "? mem -> " + *rd;
 	}
 
@@ -0,0 +1,225 @@
+// Runs programs in a headless VM for a fixed number of instructions and reports how fast they ran. Each program runs
+// in its own child process so that its peak RSS can be measured independently of the others.
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "BenchUtil.h"
+#include "VM.h"
+
+namespace {
+	using namespace WVM;
+
+	/** What a child process sends back to the parent through a pipe. */
+	struct Report {
+		uint64_t instructions = 0;
+		/** The number of times the program was started. Programs that halt before the budget is used up restart. */
+		uint64_t runs = 0;
+		/** Time spent executing instructions, excluding loading and restarting. */
+		double seconds = 0;
+		char error[256] {};
+	};
+
+	struct Result {
+		std::string name;
+		std::string path;
+		Report report;
+		/** In KiB. */
+		long peakRSS = 0;
+	};
+
+	void usage(const char *argv0) {
+		std::cerr << "Usage: " << argv0 << " [--budget <instructions>] [--memory <bytes>] [--json <path|->] [--verbose] "
+		             "<executable>...\n";
+	}
+
+	/** Puts the VM back into the state it was in right after loading without reading the program from disk again. */
+	void restart(VM &vm) {
+		vm.reset();
+		vm.start();
+	}
+
+	Report runChild(const std::string &path, UWord budget, size_t memory_size) {
+		Report report;
+		try {
+			VM vm(memory_size, true);
+			vm.load(path);
+			vm.start();
+			report.runs = 1;
+
+			while (report.instructions < budget) {
+				const auto start = std::chrono::steady_clock::now();
+				bool halted = false;
+				uint64_t instructions = report.instructions;
+				while (instructions < budget) {
+					++instructions;
+					if (!vm.tick()) {
+						halted = true;
+						break;
+					}
+				}
+				report.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				report.instructions = instructions;
+
+				if (halted && report.instructions < budget) {
+					restart(vm);
+					++report.runs;
+				}
+			}
+		} catch (const std::exception &err) {
+			std::strncpy(report.error, err.what(), sizeof(report.error) - 1);
+		}
+
+		return report;
+	}
+
+	Result run(const std::string &path, UWord budget, size_t memory_size, bool verbose) {
+		Result result;
+		result.path = path;
+		result.name = std::filesystem::path(path).stem().string();
+
+		int fds[2];
+		if (pipe(fds) == -1)
+			throw std::runtime_error("pipe() failed: " + std::string(strerror(errno)));
+
+		const pid_t pid = fork();
+		if (pid == -1)
+			throw std::runtime_error("fork() failed: " + std::string(strerror(errno)));
+
+		if (pid == 0) {
+			close(fds[0]);
+			if (!verbose) {
+				// The programs' own output (and the VM's chatter about paging and so on) would drown out the results.
+				const int null = open("/dev/null", O_WRONLY);
+				if (null != -1) {
+					dup2(null, STDOUT_FILENO);
+					dup2(null, STDERR_FILENO);
+					close(null);
+				}
+			}
+
+			const Report report = runChild(path, budget, memory_size);
+			ssize_t written = write(fds[1], &report, sizeof(report));
+			close(fds[1]);
+			_exit(written == sizeof(report)? 0 : 1);
+		}
+
+		close(fds[1]);
+		ssize_t total = 0;
+		char *buffer = reinterpret_cast<char *>(&result.report);
+		while (total < ssize_t(sizeof(Report))) {
+			const ssize_t bytes_read = read(fds[0], buffer + total, sizeof(Report) - total);
+			if (bytes_read <= 0)
+				break;
+			total += bytes_read;
+		}
+		close(fds[0]);
+
+		int status = 0;
+		rusage usage {};
+		wait4(pid, &status, 0, &usage);
+		result.peakRSS = usage.ru_maxrss;
+
+		if (total != sizeof(Report)) {
+			result.report = {};
+			std::strcpy(result.report.error, "child process exited without reporting");
+			if (WIFSIGNALED(status))
+				std::snprintf(result.report.error, sizeof(result.report.error), "child process killed by signal %d",
+					WTERMSIG(status));
+		}
+
+		return result;
+	}
+
+	double perSecond(const Report &report) {
+		return report.seconds <= 0? 0 : report.instructions / report.seconds;
+	}
+
+	void writeJSON(std::ostream &stream, const std::vector<Result> &results, UWord budget, size_t memory_size) {
+		Bench::writeJSON(stream, {{"budget", budget}, {"memory", memory_size}}, results, [&](const Result &result) {
+			const Report &report = result.report;
+			stream << "\"name\": \"" << Bench::escape(result.name) << "\", \"path\": \"" << Bench::escape(result.path)
+			       << "\", \"instructions\": " << report.instructions << ", \"runs\": " << report.runs
+			       << ", \"wallSeconds\": " << std::setprecision(9) << report.seconds << ", \"instructionsPerSecond\": "
+			       << std::fixed << std::setprecision(0) << perSecond(report) << std::defaultfloat
+			       << ", \"peakRSSKiB\": " << result.peakRSS << ", \"error\": " << Bench::jsonError(report.error);
+		});
+	}
+
+	void writeTable(std::ostream &stream, const std::vector<Result> &results) {
+		const size_t width = Bench::nameWidth(results);
+
+		stream << std::left << std::setw(width) << "Benchmark" << std::right << std::setw(16) << "Instructions"
+		       << std::setw(7) << "Runs" << std::setw(12) << "Wall (ms)" << std::setw(14) << "Instr/s"
+		       << std::setw(16) << "Peak RSS (KiB)" << '\n';
+		for (const Result &result: results) {
+			const Report &report = result.report;
+			stream << std::left << std::setw(width) << result.name << std::right;
+			if (report.error[0] != '\0') {
+				stream << "  failed: " << report.error << '\n';
+				continue;
+			}
+			stream << std::setw(16) << report.instructions << std::setw(7) << report.runs << std::setw(12)
+			       << std::fixed << std::setprecision(1) << report.seconds * 1000 << std::setw(14)
+			       << std::setprecision(0) << perSecond(report) << std::defaultfloat << std::setw(16)
+			       << result.peakRSS << '\n';
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	UWord budget = 50'000'000;
+	UWord memory_size = 64 * 1024 * 1024;
+	std::string json_path;
+	bool verbose = false;
+
+	int first = 1;
+	for (; first < argc && std::string(argv[first]).substr(0, 2) == "--"; ++first) {
+		const std::string option = argv[first];
+		if (option == "--budget" && first + 1 < argc) {
+			if (!Bench::parsePositive(argv[++first], budget, "budget"))
+				return 1;
+		} else if (option == "--memory" && first + 1 < argc) {
+			if (!Bench::parsePositive(argv[++first], memory_size, "memory size"))
+				return 1;
+		} else if (option == "--json" && first + 1 < argc) {
+			json_path = argv[++first];
+		} else if (option == "--verbose") {
+			verbose = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc <= first) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<Result> results;
+	bool failed = false;
+	for (int i = first; i < argc; ++i) {
+		results.push_back(run(argv[i], budget, memory_size, verbose));
+		failed = failed || results.back().report.error[0] != '\0';
+	}
+
+	if (!Bench::report(json_path, [&](std::ostream &stream) {
+		writeTable(stream, results);
+	}, [&](std::ostream &stream) {
+		writeJSON(stream, results, budget, memory_size);
+	}))
+		return 1;
+
+	return failed? 1 : 0;
+}
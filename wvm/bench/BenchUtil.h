@@ -0,0 +1,93 @@
+#pragma once
+
+// Helpers shared by the benchmark programs that run executables given on the command line and report one result for
+// each as a table or as JSON.
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Defs.h"
+#include "Util.h"
+
+namespace WVM::Bench {
+	/** Escapes a string for use in a JSON string literal. */
+	inline std::string escape(const std::string &str) {
+		std::stringstream ss;
+		for (const char ch: str) {
+			if (ch == '"' || ch == '\\')
+				ss << '\\' << ch;
+			else if (static_cast<unsigned char>(ch) < 0x20)
+				ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(ch) << std::dec;
+			else
+				ss << ch;
+		}
+		return ss.str();
+	}
+
+	/** Returns an error message as a JSON string, or null if there wasn't an error. */
+	inline std::string jsonError(const std::string &error) {
+		return error.empty()? "null" : '"' + escape(error) + '"';
+	}
+
+	/** Parses the value of an option that has to be a positive integer. Complains on stderr if it isn't one. */
+	inline bool parsePositive(const char *value, UWord &out, const char *what) {
+		if (Util::parseUL(value, out) && out != 0)
+			return true;
+		std::cerr << "Invalid " << what << ": " << value << "\n";
+		return false;
+	}
+
+	/** Returns the width of the first column of a table of results, which holds their names under "Benchmark". */
+	template <typename R>
+	size_t nameWidth(const std::vector<R> &results) {
+		size_t width = 9;
+		for (const R &result: results)
+			width = std::max(width, result.name.size());
+		return width;
+	}
+
+	/** Writes a JSON object with some parameters of the run and a "results" array. write_result writes the members of
+	 *  a result's object. */
+	template <typename R, typename F>
+	void writeJSON(std::ostream &stream, const std::vector<std::pair<std::string, uint64_t>> &parameters,
+	               const std::vector<R> &results, const F &write_result) {
+		stream << '{';
+		for (const auto &[key, value]: parameters)
+			stream << "\n\t\"" << key << "\": " << value << ',';
+		stream << "\n\t\"results\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			stream << (i == 0? "\n" : ",\n") << "\t\t{";
+			write_result(results[i]);
+			stream << '}';
+		}
+		stream << "\n\t]\n}\n";
+	}
+
+	/** Writes the table to stdout and, if there's a path for the JSON, the JSON to it. The JSON goes to stdout instead
+	 *  of the table if the path is "-". Returns false if the file couldn't be opened. */
+	template <typename T, typename J>
+	bool report(const std::string &json_path, const T &write_table, const J &write_json) {
+		if (json_path == "-") {
+			write_json(std::cout);
+			return true;
+		}
+
+		write_table(std::cout);
+		if (json_path.empty())
+			return true;
+
+		std::ofstream stream(json_path);
+		if (!stream) {
+			std::cerr << "Couldn't open " << json_path << " for writing.\n";
+			return false;
+		}
+		write_json(stream);
+		return true;
+	}
+}
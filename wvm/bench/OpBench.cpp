@@ -0,0 +1,443 @@
+// Measures the host cost of each operation handler in Operations.h in isolation by calling it directly in a loop. Every
+// handler is measured with paging off and on, with history off and on and with observers detached and attached.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Operations.h"
+#include "Util.h"
+#include "VM.h"
+#include "Why.h"
+
+namespace {
+	using namespace WVM;
+	using namespace WVM::Operations;
+
+	constexpr size_t MEMORY_SIZE = 32 * 1024 * 1024;
+	/** The page tables identity-map the first 256 pages (16 MiB). */
+	constexpr Word PAGE_TABLES = 0x100000;
+	constexpr Word CODE = 0x10000;
+	constexpr Word SCRATCH_A = 0x20000;
+	constexpr Word SCRATCH_B = 0x20100;
+	constexpr Word STACK = 0x800000;
+	/** The number of calls between two reads of the clock. State is restored between batches. */
+	constexpr size_t BATCH = 256;
+
+	constexpr int RS = Why::temporaryOffset, RT = Why::temporaryOffset + 1, RD = Why::temporaryOffset + 2;
+
+	/** Register indices, the values to put in them and the other arguments passed to a handler. */
+	struct Operands {
+		int rs = RS, rt = RT, rd = RD;
+		Word rsValue = 1234567, rtValue = 3, rdValue = 0;
+		HWord immediate = 3;
+		Conditions conditions = Conditions::Disabled;
+		bool link = false;
+	};
+
+	struct Case {
+		const char *name;
+		void (*call)(VM &, const Operands &);
+		/** Adjusts the default operands and the VM before a batch. */
+		void (*prepare)(VM &, Operands &) = nullptr;
+		/** Whether the handler writes to stdout or stderr every time it's called. */
+		bool quiet = false;
+	};
+
+	struct Variant {
+		bool paging, history, observers;
+		std::string label() const {
+			std::string out;
+			if (paging)
+				out += 'P';
+			if (history)
+				out += 'H';
+			if (observers)
+				out += 'O';
+			return out.empty()? "plain" : out;
+		}
+	};
+
+	/** Incremented by the attached observers. */
+	uint64_t events = 0;
+
+#define R_OP(name) +[](VM &vm, const Operands &o) { \
+	name##Op(vm, vm.registers[o.rs], vm.registers[o.rt], vm.registers[o.rd], o.conditions, 0); }
+#define I_OP(name) +[](VM &vm, const Operands &o) { \
+	name##Op(vm, vm.registers[o.rs], vm.registers[o.rd], o.conditions, 0, o.immediate); }
+#define J_OP(name) +[](VM &vm, const Operands &o) { \
+	name##Op(vm, vm.registers[o.rs], o.link, o.conditions, 0, o.immediate); }
+
+	/** $rs and $rd point to scratch memory. The word at $rs points to the word at $rd so that loads keep $rd valid. */
+	void memory(VM &vm, Operands &o) {
+		o.rsValue = SCRATCH_A;
+		o.rdValue = SCRATCH_B;
+		vm.setWord(SCRATCH_A, SCRATCH_B);
+	}
+
+	void immediateAddress(VM &vm, Operands &o) {
+		memory(vm, o);
+		o.immediate = SCRATCH_A;
+	}
+
+	void smallRs(VM &, Operands &o) {
+		o.rsValue = 3;
+	}
+
+	void jumpTarget(VM &, Operands &o) {
+		o.rsValue = 1;
+		o.rdValue = CODE;
+		o.immediate = CODE;
+	}
+
+	void zeroRing(VM &, Operands &o) {
+		o.rsValue = 0;
+		o.immediate = 0;
+	}
+
+	void sized(VM &, Operands &o) {
+		o.immediate = 8;
+	}
+
+	std::vector<Case> makeCases() {
+		return {
+			{"add",    R_OP(add)},
+			{"sub",    R_OP(sub)},
+			{"mult",   R_OP(mult)},
+			{"multu",  R_OP(multu)},
+			{"sll",    R_OP(sll)},
+			{"srl",    R_OP(srl)},
+			{"sra",    R_OP(sra)},
+			{"mod",    R_OP(mod)},
+			{"div",    R_OP(div)},
+			{"divu",   R_OP(divu)},
+			{"modu",   R_OP(modu)},
+			{"sext32", R_OP(sext32)},
+			{"sext16", R_OP(sext16)},
+			{"sext8",  R_OP(sext8)},
+			{"and",    R_OP(and)},
+			{"nand",   R_OP(nand)},
+			{"nor",    R_OP(nor)},
+			{"not",    R_OP(not)},
+			{"or",     R_OP(or)},
+			{"xnor",   R_OP(xnor)},
+			{"xor",    R_OP(xor)},
+			{"land",   R_OP(land)},
+			{"lnand",  R_OP(lnand)},
+			{"lnor",   R_OP(lnor)},
+			{"lnot",   R_OP(lnot)},
+			{"lor",    R_OP(lor)},
+			{"lxnor",  R_OP(lxnor)},
+			{"lxor",   R_OP(lxor)},
+			{"addi",   I_OP(addi)},
+			{"subi",   I_OP(subi)},
+			{"multi",  I_OP(multi)},
+			{"andi",   I_OP(andi)},
+			{"nandi",  I_OP(nandi)},
+			{"nori",   I_OP(nori)},
+			{"ori",    I_OP(ori)},
+			{"xnori",  I_OP(xnori)},
+			{"xori",   I_OP(xori)},
+			{"lui",    I_OP(lui)},
+			{"sl",     R_OP(sl)},
+			{"sle",    R_OP(sle)},
+			{"seq",    R_OP(seq)},
+			{"slu",    R_OP(slu)},
+			{"sleu",   R_OP(sleu)},
+			{"cmp",    R_OP(cmp)},
+			{"j",      J_OP(j),    jumpTarget},
+			{"jc",     J_OP(jc),   jumpTarget},
+			{"jr",     R_OP(jr),   jumpTarget},
+			{"jrc",    R_OP(jrc),  jumpTarget},
+			{"jrl",    R_OP(jrl),  jumpTarget},
+			{"jrlc",   R_OP(jrlc), jumpTarget},
+			{"c",      R_OP(c),    memory},
+			{"l",      R_OP(l),    memory},
+			{"s",      R_OP(s),    memory},
+			{"cb",     R_OP(cb),   memory},
+			{"lb",     R_OP(lb),   memory},
+			{"sb",     R_OP(sb),   memory},
+			{"spush",  R_OP(spush)},
+			{"spop",   R_OP(spop)},
+			{"ch",     R_OP(ch),   memory},
+			{"lh",     R_OP(lh),   memory},
+			{"sh",     R_OP(sh),   memory},
+			{"ms",     R_OP(ms),   +[](VM &vm, Operands &o) { memory(vm, o); o.rsValue = 64; o.rtValue = 42; }},
+			{"cs",     R_OP(cs),   memory},
+			{"ls",     R_OP(ls),   memory},
+			{"ss",     R_OP(ss),   memory},
+			{"li",     I_OP(li),   immediateAddress},
+			{"si",     I_OP(si),   immediateAddress},
+			{"set",    I_OP(set)},
+			{"sps",    I_OP(sps),  sized},
+			{"spl",    I_OP(spl),  sized},
+			{"multui", I_OP(multui)},
+			{"sli",    I_OP(sli)},
+			{"slei",   I_OP(slei)},
+			{"seqi",   I_OP(seqi)},
+			{"slui",   I_OP(slui)},
+			{"sleui",  I_OP(sleui)},
+			{"modi",   I_OP(modi)},
+			{"pr",     R_OP(pr),   nullptr, true},
+			{"halt",   R_OP(halt)},
+			{"eval",   R_OP(eval), nullptr, true},
+			{"prc",    R_OP(prc),  +[](VM &, Operands &o) { o.rsValue = 'x'; }},
+			{"prd",    R_OP(prd)},
+			{"prx",    R_OP(prx)},
+			{"sleep",  R_OP(sleep), +[](VM &, Operands &o) { o.rsValue = 0; }},
+			{"prb",    R_OP(prb)},
+			{"rest",   R_OP(rest)},
+			{"io",     R_OP(io),   +[](VM &vm, Operands &) { vm.registers[Why::argumentOffset] = IO_DEVCOUNT; }},
+			{"int",    I_OP(int),  +[](VM &, Operands &o) { o.immediate = int(InterruptType::System); }},
+			{"rit",    I_OP(rit),  immediateAddress},
+			{"slli",   I_OP(slli)},
+			{"srli",   I_OP(srli)},
+			{"srai",   I_OP(srai)},
+			{"lbi",    I_OP(lbi),  immediateAddress},
+			{"sbi",    I_OP(sbi),  immediateAddress},
+			{"lni",    I_OP(lni),  immediateAddress},
+			{"lbni",   I_OP(lbni), immediateAddress},
+			{"sgi",    I_OP(sgi)},
+			{"sgei",   I_OP(sgei)},
+			{"cmpi",   I_OP(cmpi)},
+			// The timer is never allowed to fire.
+			{"time",   R_OP(time),  +[](VM &, Operands &o) { o.rsValue = Word(1) << 40; }},
+			{"svtime", R_OP(svtime)},
+			{"timei",  I_OP(timei), +[](VM &, Operands &o) { o.immediate = 0x7fffffff; }},
+			{"ring",   R_OP(ring),  zeroRing},
+			{"svring", R_OP(svring)},
+			{"ringi",  I_OP(ringi), zeroRing},
+			{"divi",   I_OP(divi)},
+			{"divui",  I_OP(divui)},
+			{"divii",  I_OP(divii)},
+			{"divuii", I_OP(divuii)},
+			{"sel",    R_OP(sel)},
+			{"sspush", I_OP(sspush), sized},
+			{"sspop",  I_OP(sspop),  sized},
+			{"sgeui",  I_OP(sgeui)},
+			{"sgui",   I_OP(sgui)},
+			{"pgoff",  R_OP(pgoff), nullptr, true},
+			{"pgon",   R_OP(pgon),  nullptr, true},
+			{"setpt",  R_OP(setpt), +[](VM &, Operands &o) { o.rsValue = PAGE_TABLES; o.rt = 0; }, true},
+			{"svpg",   R_OP(svpg)},
+			{"ppush",  R_OP(ppush)},
+			{"ppop",   R_OP(ppop),  +[](VM &vm, Operands &o) {
+				o.rs = 0;
+				vm.pagingStack.assign(BATCH, PagingState(vm));
+			}},
+			{"sllii",  I_OP(sllii), smallRs},
+			{"srlii",  I_OP(srlii), smallRs},
+			{"sraii",  I_OP(sraii), smallRs},
+			{"qm",     R_OP(qm)},
+			{"qc",     R_OP(qc),    +[](VM &, Operands &o) { o.rsValue = 0; }},
+			{"di",     R_OP(di)},
+			{"ei",     R_OP(ei)},
+			{"modui",  I_OP(modui)},
+			{"trans",  R_OP(trans), memory},
+			// Decoding and dispatch on top of the cheapest handler, for comparison.
+			{"execute(add)", +[](VM &vm, const Operands &o) {
+				execute(vm, Util::swapEndian(UWord(OP_ADD) << 52 | UWord(o.rt) << 45 | UWord(o.rs) << 38 |
+				                             UWord(o.rd) << 31 | FN_ADD));
+			}},
+		};
+	}
+
+	void mapPages(VM &vm) {
+		const Word p1 = PAGE_TABLES + 2048, p2 = p1 + 2048, p3 = p2 + 2048, p4 = p3 + 2048, p5 = p4 + 2048;
+		vm.setWord(PAGE_TABLES, p1 | 1);
+		vm.setWord(p1, p2 | 1);
+		vm.setWord(p2, p3 | 1);
+		vm.setWord(p3, p4 | 1);
+		vm.setWord(p4, p5 | 1);
+		// Present, writable and executable.
+		for (Word page = 0; page < 256; ++page)
+			vm.setWord(p5 + page * 8, page << 16 | 0b111);
+	}
+
+	void setObservers(VM &vm, bool attached) {
+		if (attached) {
+			vm.onRegisterChange = [](unsigned char) { ++events; };
+			vm.onRingChange = [](Ring, Ring) { ++events; };
+			vm.onInterruptTableChange = [] { ++events; };
+			vm.onUpdateMemory = [](Word, Word, Word, Size) { ++events; };
+			vm.onJump = [](Word, Word) { ++events; };
+			vm.onPrint = [](const std::string &str) { events += str.size(); };
+			vm.onPagingChange = [](bool) { ++events; };
+			vm.onP0Change = [](Word) { ++events; };
+		} else {
+			vm.onRegisterChange = [](unsigned char) {};
+			vm.onRingChange = [](Ring, Ring) {};
+			vm.onInterruptTableChange = [] {};
+			vm.onUpdateMemory = [](Word, Word, Word, Size) {};
+			vm.onJump = [](Word, Word) {};
+			vm.onPrint = [](const std::string &) {};
+			vm.onPagingChange = [](bool) {};
+			vm.onP0Change = [](Word) {};
+		}
+	}
+
+	/** Puts the VM into a known state and applies the operands. Not timed. */
+	Operands restore(VM &vm, const Case &test, const Variant &variant) {
+		std::fill(std::begin(vm.registers), std::end(vm.registers), 0);
+		vm.sp() = vm.fp() = STACK;
+		vm.programCounter = CODE;
+		vm.ring = Ring::Zero;
+		vm.p0 = PAGE_TABLES;
+		vm.pagingOn = variant.paging;
+		vm.pagingStack.clear();
+		vm.interruptTableAddress = 0;
+		vm.hardwareInterruptsEnabled = true;
+		vm.resting = false;
+		// Stops the timer thread started by the time handlers so that it doesn't compete with later measurements.
+		vm.timerActive = false;
+		vm.clearHistory();
+		vm.start();
+
+		Operands operands;
+		if (test.prepare)
+			test.prepare(vm, operands);
+		if (operands.rs != 0)
+			vm.registers[operands.rs] = operands.rsValue;
+		if (operands.rt != 0)
+			vm.registers[operands.rt] = operands.rtValue;
+		if (operands.rd != 0)
+			vm.registers[operands.rd] = operands.rdValue;
+		return operands;
+	}
+
+	/** Returns the average cost of one call in nanoseconds. */
+	double measure(VM &vm, const Case &test, const Variant &variant, std::chrono::nanoseconds min_time) {
+		std::streambuf *cout_buffer = nullptr, *cerr_buffer = nullptr;
+		if (test.quiet) {
+			cout_buffer = std::cout.rdbuf(nullptr);
+			cerr_buffer = std::cerr.rdbuf(nullptr);
+		}
+
+		vm.enableHistory = variant.history;
+		setObservers(vm, variant.observers);
+
+		std::chrono::nanoseconds elapsed {0};
+		size_t calls = 0;
+		bool warm = false;
+		while (!warm || elapsed < min_time) {
+			const Operands operands = restore(vm, test, variant);
+			const auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < BATCH; ++i)
+				test.call(vm, operands);
+			const auto end = std::chrono::steady_clock::now();
+			if (warm) {
+				elapsed += end - start;
+				calls += BATCH;
+			}
+			warm = true;
+		}
+
+		vm.enableHistory = false;
+		vm.clearHistory();
+		if (test.quiet) {
+			std::cout.rdbuf(cout_buffer);
+			std::cerr.rdbuf(cerr_buffer);
+			std::cout.clear();
+			std::cerr.clear();
+		}
+
+		return double(elapsed.count()) / calls;
+	}
+
+	void usage(const char *argv0) {
+		std::cerr << "Usage: " << argv0 << " [--filter <substring>] [--min-time <milliseconds>] [--json <path|->]\n";
+	}
+}
+
+int main(int argc, char **argv) {
+	std::string filter, json_path;
+	UWord min_time_ms = 10;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string option = argv[i];
+		if (option == "--filter" && i + 1 < argc) {
+			filter = argv[++i];
+		} else if (option == "--min-time" && i + 1 < argc) {
+			if (!Util::parseUL(argv[++i], min_time_ms) || min_time_ms == 0) {
+				std::cerr << "Invalid minimum time: " << argv[i] << "\n";
+				return 1;
+			}
+		} else if (option == "--json" && i + 1 < argc) {
+			json_path = argv[++i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	VM vm(MEMORY_SIZE, false);
+	vm.memory.resize(MEMORY_SIZE);
+	mapPages(vm);
+
+	std::vector<Variant> variants;
+	for (int i = 0; i < 8; ++i)
+		variants.push_back({(i & 1) != 0, (i & 2) != 0, (i & 4) != 0});
+
+	const std::chrono::milliseconds min_time(min_time_ms);
+	std::vector<Case> cases = makeCases();
+	if (!filter.empty())
+		cases.erase(std::remove_if(cases.begin(), cases.end(), [&](const Case &test) {
+			return std::string(test.name).find(filter) == std::string::npos;
+		}), cases.end());
+
+	const bool table = json_path != "-";
+	if (table) {
+		std::cout << "ns/op. P: paging on, H: history on, O: observers attached.\n\n" << std::left << std::setw(14)
+		          << "Operation" << std::right;
+		for (const Variant &variant: variants)
+			std::cout << std::setw(9) << variant.label();
+		std::cout << '\n';
+	}
+
+	std::vector<std::vector<double>> results;
+	for (const Case &test: cases) {
+		results.emplace_back();
+		if (table)
+			std::cout << std::left << std::setw(14) << test.name << std::right << std::flush;
+		for (const Variant &variant: variants) {
+			results.back().push_back(measure(vm, test, variant, min_time));
+			if (table)
+				std::cout << std::setw(9) << std::fixed << std::setprecision(1) << results.back().back() << std::flush;
+		}
+		if (table)
+			std::cout << '\n';
+	}
+
+	// Lets the timer thread started by the time handlers exit before the VM is destroyed.
+	vm.timerActive = false;
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	if (!json_path.empty()) {
+		std::ofstream file;
+		if (json_path != "-") {
+			file.open(json_path);
+			if (!file) {
+				std::cerr << "Couldn't open " << json_path << " for writing.\n";
+				return 1;
+			}
+		}
+
+		std::ostream &stream = json_path == "-"? std::cout : file;
+		stream << "{\n\t\"minTimeMs\": " << min_time_ms << ",\n\t\"results\": [";
+		bool first = true;
+		for (size_t i = 0; i < cases.size(); ++i)
+			for (size_t j = 0; j < variants.size(); ++j) {
+				stream << (first? "\n" : ",\n") << "\t\t{\"op\": \"" << cases[i].name << "\", \"paging\": "
+				       << std::boolalpha << variants[j].paging << ", \"history\": " << variants[j].history
+				       << ", \"observers\": " << variants[j].observers << ", \"nsPerOp\": " << std::fixed
+				       << std::setprecision(2) << results[i][j] << '}';
+				first = false;
+			}
+		stream << "\n\t]\n}\n";
+	}
+}
@@ -0,0 +1,164 @@
+// Measures how fast programs can be run and reset over and over, the way a fuzzer or a test loop uses the VM. Each
+// round runs a program until it halts or a step limit is reached and then resets it, both by restoring the pages it
+// wrote and by reloading it from disk for comparison.
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "VM.h"
+
+namespace {
+	using namespace WVM;
+
+	struct Measurement {
+		uint64_t rounds = 0;
+		/** Time spent executing instructions and time spent resetting. */
+		double runSeconds = 0, resetSeconds = 0;
+
+		double resetsPerSecond() const { return resetSeconds <= 0? 0 : rounds / resetSeconds; }
+		double roundsPerSecond() const { return runSeconds + resetSeconds <= 0? 0 : rounds / (runSeconds + resetSeconds); }
+		double microsPerReset() const { return rounds == 0? 0 : resetSeconds * 1e6 / rounds; }
+	};
+
+	struct Result {
+		std::string name;
+		std::string path;
+		Measurement restore, reload;
+		std::string error;
+	};
+
+	void usage(const char *argv0) {
+		std::cerr << "Usage: " << argv0 << " [--steps <instructions>] [--min-time <milliseconds>] [--memory <bytes>] "
+		             "[--json <path|->] <executable>...\n";
+	}
+
+	Measurement measure(VM &vm, bool reload, UWord steps, std::chrono::nanoseconds min_time) {
+		using Clock = std::chrono::steady_clock;
+		Measurement out;
+		Clock::duration run {}, reset {};
+		// At least one round is run, which also makes a minimum time of zero a single warm-up round.
+		do {
+			const auto start = Clock::now();
+			vm.start();
+			for (UWord i = 0; i < steps && vm.tick(); ++i);
+			const auto ran = Clock::now();
+			vm.reset(reload);
+			const auto end = Clock::now();
+			run += ran - start;
+			reset += end - ran;
+			++out.rounds;
+		} while (run + reset < min_time);
+		out.runSeconds = std::chrono::duration<double>(run).count();
+		out.resetSeconds = std::chrono::duration<double>(reset).count();
+		return out;
+	}
+
+	Result run(const std::string &path, UWord steps, size_t memory_size, std::chrono::nanoseconds min_time) {
+		Result result;
+		result.path = path;
+		result.name = std::filesystem::path(path).stem().string();
+
+		// The programs' own output (and the VM's chatter about paging and so on) would drown out the results.
+		std::streambuf *cout_buffer = std::cout.rdbuf(nullptr), *cerr_buffer = std::cerr.rdbuf(nullptr);
+		try {
+			VM vm(memory_size, true);
+			vm.load(path);
+			// One untimed round so that both kinds of reset start with the pages the program writes already mapped.
+			measure(vm, false, steps, {});
+			result.restore = measure(vm, false, steps, min_time);
+			result.reload = measure(vm, true, steps, min_time);
+		} catch (const std::exception &err) {
+			result.error = err.what();
+		}
+		std::cout.rdbuf(cout_buffer);
+		std::cerr.rdbuf(cerr_buffer);
+		std::cout.clear();
+		std::cerr.clear();
+
+		return result;
+	}
+
+	void writeJSON(std::ostream &stream, const std::vector<Result> &results, UWord steps, size_t memory_size) {
+		Bench::writeJSON(stream, {{"steps", steps}, {"memory", memory_size}}, results, [&](const Result &result) {
+			stream << "\"name\": \"" << Bench::escape(result.name) << "\", \"path\": \"" << Bench::escape(result.path)
+			       << "\", \"rounds\": " << result.restore.rounds << ", \"resetsPerSecond\": " << std::fixed
+			       << std::setprecision(0) << result.restore.resetsPerSecond() << ", \"roundsPerSecond\": "
+			       << result.restore.roundsPerSecond() << ", \"reloadsPerSecond\": " << result.reload.resetsPerSecond()
+			       << std::defaultfloat << ", \"error\": " << Bench::jsonError(result.error);
+		});
+	}
+
+	void writeTable(std::ostream &stream, const std::vector<Result> &results) {
+		const size_t width = Bench::nameWidth(results);
+
+		stream << std::left << std::setw(width) << "Benchmark" << std::right << std::setw(10) << "Rounds"
+		       << std::setw(12) << "Resets/s" << std::setw(12) << "Reset (us)" << std::setw(12) << "Rounds/s"
+		       << std::setw(13) << "Reload (us)" << '\n';
+		for (const Result &result: results) {
+			stream << std::left << std::setw(width) << result.name << std::right;
+			if (!result.error.empty()) {
+				stream << "  failed: " << result.error << '\n';
+				continue;
+			}
+			stream << std::setw(10) << result.restore.rounds << std::fixed << std::setprecision(0) << std::setw(12)
+			       << result.restore.resetsPerSecond() << std::setprecision(1) << std::setw(12)
+			       << result.restore.microsPerReset() << std::setprecision(0) << std::setw(12)
+			       << result.restore.roundsPerSecond() << std::setprecision(1) << std::setw(13)
+			       << result.reload.microsPerReset() << std::defaultfloat << '\n';
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	UWord steps = 10'000;
+	UWord min_time_ms = 1000;
+	UWord memory_size = 256 * 1024 * 1024;
+	std::string json_path;
+
+	int first = 1;
+	for (; first < argc && std::string(argv[first]).substr(0, 2) == "--"; ++first) {
+		const std::string option = argv[first];
+		if (option == "--steps" && first + 1 < argc) {
+			if (!Bench::parsePositive(argv[++first], steps, "step count"))
+				return 1;
+		} else if (option == "--min-time" && first + 1 < argc) {
+			if (!Bench::parsePositive(argv[++first], min_time_ms, "minimum time"))
+				return 1;
+		} else if (option == "--memory" && first + 1 < argc) {
+			if (!Bench::parsePositive(argv[++first], memory_size, "memory size"))
+				return 1;
+		} else if (option == "--json" && first + 1 < argc) {
+			json_path = argv[++first];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc <= first) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const std::chrono::milliseconds min_time(min_time_ms);
+	std::vector<Result> results;
+	bool failed = false;
+	for (int i = first; i < argc; ++i) {
+		results.push_back(run(argv[i], steps, memory_size, min_time));
+		failed = failed || !results.back().error.empty();
+	}
+
+	if (!Bench::report(json_path, [&](std::ostream &stream) {
+		writeTable(stream, results);
+	}, [&](std::ostream &stream) {
+		writeJSON(stream, results, steps, memory_size);
+	}))
+		return 1;
+
+	return failed? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Defs.h"
+
+namespace WVM {
+	class VM;
+
+	/** A breakpoint condition such as "$a0 == 5 && [$sp + 8] != 0", compiled once into a small stack bytecode so that
+	 *  evaluating it at every hit doesn't involve any parsing. Square brackets read a little-endian word from a virtual
+	 *  address; names without a dollar sign are symbols and "pc" is the program counter. */
+	class BreakCondition {
+		public:
+			enum class Op: UByte {
+				Push, Register, PC, Load, Negate, Not, Complement, Multiply, Divide, Modulo, Add, Subtract, ShiftLeft,
+				ShiftRight, Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, BitAnd, BitXor, BitOr, And, Or
+			};
+
+			struct Instruction {
+				Op op;
+				Word operand = 0;
+				Instruction(Op op_, Word operand_ = 0): op(op_), operand(operand_) {}
+			};
+
+			static constexpr size_t MAX_DEPTH = 32;
+
+			/** Throws std::runtime_error if the expression is invalid. Symbols are resolved immediately. */
+			static BreakCondition compile(const std::string &source, const VM &);
+
+			bool evaluate(VM &) const;
+			const std::string & getSource() const { return source; }
+			const std::vector<Instruction> & getCode() const { return code; }
+
+		private:
+			std::string source;
+			std::vector<Instruction> code;
+
+			BreakCondition(const std::string &source_, std::vector<Instruction> &&code_):
+				source(source_), code(std::move(code_)) {}
+	};
+
+	/** Extra conditions attached to a breakpoint. A plain breakpoint has no rule. */
+	struct BreakpointRule {
+		std::optional<BreakCondition> condition;
+		/** Execution stops on the nth hit whose condition holds and on every one after it. 0 and 1 stop on the first. */
+		UWord after = 0;
+		UWord hits = 0;
+
+		/** Counts a hit and returns whether execution should stop. */
+		bool hit(VM &);
+		std::string describe() const;
+	};
+}
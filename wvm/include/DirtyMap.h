@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "Defs.h"
+
+namespace WVM {
+	/** Records which 8-byte words of physical memory have been written since the last drain. A second, coarser bitmap
+	 *  marks which 64-bit entries of the first one are nonzero so that draining a mostly clean memory doesn't have to
+	 *  scan all of it. Disabled (and free) until enable() is called. Not thread-safe: callers hold the VM's lock. */
+	class DirtyMap {
+		public:
+			void enable(size_t memory_size);
+			void disable();
+			bool isEnabled() const { return !words.empty(); }
+			/** Keeps existing marks within the new size. Does nothing while disabled. */
+			void resize(size_t memory_size);
+
+			inline void mark(Word address, Word length) {
+				if (words.empty())
+					return;
+				const UWord last = UWord(address + length - 1) >> 3;
+				for (UWord word = UWord(address) >> 3; word <= last && word < wordCount; ++word) {
+					words[word >> 6] |= UWord(1) << (word & 63);
+					summary[word >> 12] |= UWord(1) << ((word >> 6) & 63);
+				}
+			}
+
+			/** Calls the function with the byte address and word count of each run of consecutive dirty words, in
+			 *  ascending order and at most max_words long, and clears every mark. */
+			void drain(const std::function<void(Word address, size_t count)> &, size_t max_words = 4096);
+
+		private:
+			size_t wordCount = 0;
+			/** One bit per word of memory. */
+			std::vector<UWord> words;
+			/** One bit per element of words. */
+			std::vector<UWord> summary;
+	};
+}
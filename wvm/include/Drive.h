@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace WVM {
+	/** A file the guest reads and writes with I/O instructions. The drives of a forked VM are overlays: pages they
+	 *  haven't written are read from a snapshot of the parent's drive, and a page is copied into a file of the overlay's
+	 *  own the first time it's written. */
+	class Drive {
+		public:
+			const std::string name;
+
+			/** Takes ownership of an open descriptor. */
+			Drive(const std::string &name_, int descriptor_): name(name_), descriptor(descriptor_) {}
+			Drive(Drive &&);
+			~Drive();
+
+			Drive(const Drive &) = delete;
+			Drive & operator=(const Drive &) = delete;
+			Drive & operator=(Drive &&) = delete;
+
+			/** These work like lseek(2), read(2) and write(2), returning -1 and setting errno on failure. */
+			off_t seek(off_t offset, int whence);
+			ssize_t read(void *buffer, size_t count);
+			ssize_t write(const void *buffer, size_t count);
+
+			/** Copies the drive's current contents and cursor into a new memory file that overlays can share. */
+			Drive snapshot() const;
+			/** Returns an overlay on a drive returned by snapshot(). Nothing may write to the snapshot afterwards. */
+			Drive overlay() const;
+
+		private:
+			static constexpr size_t PAGE_SIZE = 4096;
+
+			int descriptor;
+			/** For overlays, the snapshot that pages not yet written are read from. */
+			int base = -1;
+			/** For overlays, which pages have been copied into the overlay's own file. */
+			std::vector<bool> copied;
+			/** Overlays keep track of their own cursor and size. */
+			off_t cursor = 0, size = 0;
+
+			bool isOverlay() const { return base != -1; }
+			/** Reads from an overlay at an offset, like pread(2). */
+			ssize_t readAt(void *buffer, size_t count, off_t offset) const;
+			/** Copies the pages of an overlay's snapshot in a range into the overlay's own file. */
+			bool copyUp(off_t start, off_t end);
+	};
+}
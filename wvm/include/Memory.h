@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include "Defs.h"
+
+namespace WVM {
+	/** Guest memory, stored in an anonymous memory file so that other local processes can map it too. Pages that have
+	 *  never been touched don't take up any memory, and copying only copies the pages the source has. Resizing and
+	 *  assigning keep the same file, so existing mappings of it stay valid as long as it doesn't shrink.
+	 *
+	 *  Forked memory is a private mapping of a snapshot's file instead: it shares the snapshot's pages until it writes
+	 *  to them. It can't be shared with other processes or resized, and zeroing or assigning to it gives it a file of
+	 *  its own again. */
+	class Memory {
+		public:
+			Memory() = default;
+			Memory(const Memory &);
+			Memory(Memory &&);
+			~Memory();
+
+			Memory & operator=(const Memory &);
+			Memory & operator=(Memory &&);
+
+			/** Maps an existing memory file read-only. Writing to the result crashes. */
+			static Memory view(int descriptor, size_t size);
+
+			/** Returns forked memory that starts out with this memory's contents. Nothing may change this memory
+			 *  afterwards, so it should be a copy made for forking, and it can't be forked memory itself. */
+			Memory fork() const;
+
+			UByte & operator[](size_t index) { return bytes[index]; }
+			const UByte & operator[](size_t index) const { return bytes[index]; }
+
+			UByte & at(size_t index) {
+				if (length <= index)
+					throw std::out_of_range("Memory index out of range: " + std::to_string(index));
+				return bytes[index];
+			}
+
+			const UByte & at(size_t index) const {
+				if (length <= index)
+					throw std::out_of_range("Memory index out of range: " + std::to_string(index));
+				return bytes[index];
+			}
+
+			UByte * data() { return bytes; }
+			const UByte * data() const { return bytes; }
+			UByte * begin() { return bytes; }
+			UByte * end() { return bytes + length; }
+			const UByte * begin() const { return bytes; }
+			const UByte * end() const { return bytes + length; }
+			size_t size() const { return length; }
+			bool empty() const { return length == 0; }
+
+			/** Keeps the existing contents. Added bytes are zero. */
+			void resize(size_t);
+			/** Sets every byte to zero and frees the pages that held them. */
+			void zero();
+			/** Returns the memory file's descriptor, or -1 if nothing has been allocated yet or the memory is forked. */
+			int getDescriptor() const { return forked? -1 : descriptor; }
+			bool isForked() const { return forked; }
+
+		private:
+			int descriptor = -1;
+			UByte *bytes = nullptr;
+			size_t length = 0;
+			bool writable = true;
+			/** Whether the mapping is a private one of a snapshot's file. */
+			bool forked = false;
+
+			void map();
+			void unmap();
+			/** Replaces forked memory's mapping with a zeroed file of its own. */
+			void detach();
+			/** Copying forked memory only copies the parts its snapshot has data in, so whoever forked it has to copy
+			 *  the pages it has written elsewhere. */
+			void copyFrom(const Memory &);
+	};
+}
@@ -19,6 +19,8 @@ namespace WVM::Operations {
 	void decodeRType(UWord instruction, int &rs, int &rt, int &rd, Conditions &, int &flags, int &funct);
 	void decodeIType(UWord instruction, int &rs, int &rd,  Conditions &, int &flags, HWord &immediate);
 	void decodeJType(UWord instruction, int &rs, bool &link, Conditions &, int &flags, HWord &address);
+	/** Returns whether an instruction, in the byte order tick() fetches it in, is a jump that links. */
+	bool isCall(UWord instruction);
 
 	void addOp(VM &, Word &rs, Word &rt, Word &rd, Conditions, int flags);           // 1   R 0
 	void subOp(VM &, Word &rs, Word &rt, Word &rd, Conditions, int flags);           // 1   R 1
@@ -150,6 +152,7 @@ namespace WVM::Operations {
 	void srliiOp(VM &, Word &rs, Word &rd, Conditions, int flags, HWord immediate);  // 63  I
 	void sraiiOp(VM &, Word &rs, Word &rd, Conditions, int flags, HWord immediate);  // 64  I
 	void qmOp(VM &, Word &, Word &, Word &rd, Conditions, int flags);                // 65  R 0
+	void qcOp(VM &, Word &rs, Word &, Word &rd, Conditions, int flags);              // 65  R 1
 	void diOp(VM &, Word &, Word &, Word &rd, Conditions, int flags);                // 66  R 0
 	void eiOp(VM &, Word &, Word &, Word &rd, Conditions, int flags);                // 66  R 1
 	void moduiOp(VM &, Word &rs, Word &rd, Conditions, int flags, HWord immediate);  // 67  I
@@ -369,6 +372,8 @@ namespace WVM::Operations {
 #define OP_QUERY 65
 #define OP_QM OP_QUERY
 #define FN_QM 0
+#define OP_QC OP_QUERY
+#define FN_QC 1
 
 #define OP_INTERRUPTS 66
 #define FN_DI 0
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Defs.h"
+
+namespace WVM {
+	/** The memory epoch in which each page of memory was last changed. Pages are grouped into chunks, and a chunk is
+	 *  only allocated once one of its pages is set; until then, all of its pages share the epoch given to the last
+	 *  fill(). A VM that writes to little of its memory keeps (and copies, when it's forked) only a few chunks. Not
+	 *  thread-safe: callers hold the VM's lock. */
+	class PageEpochs {
+		public:
+			static constexpr size_t CHUNK_PAGES = 512;
+
+			PageEpochs(size_t page_count, UWord epoch);
+			PageEpochs(const PageEpochs &);
+			PageEpochs(PageEpochs &&) = default;
+			PageEpochs & operator=(const PageEpochs &);
+			PageEpochs & operator=(PageEpochs &&) = default;
+
+			size_t size() const { return pageCount; }
+			UWord get(size_t page) const;
+
+			inline void set(size_t page, UWord epoch) {
+				std::unique_ptr<UWord[]> &chunk = chunks[page / CHUNK_PAGES];
+				if (!chunk)
+					allocate(chunk);
+				chunk[page % CHUNK_PAGES] = epoch;
+			}
+
+			/** Sets every page to an epoch and frees every chunk. */
+			void fill(UWord epoch);
+			/** Pages added are set to the given epoch. */
+			void resize(size_t page_count, UWord epoch);
+			/** Sets every page changed after one epoch to another. */
+			void replace(UWord after, UWord epoch);
+			/** Calls the function with the first page and page count of each run of consecutive pages changed at or
+			 *  after an epoch, in ascending order. */
+			void forEachRun(UWord since, const std::function<void(size_t first, size_t count)> &) const;
+
+		private:
+			size_t pageCount;
+			/** The epoch of every page in a chunk that hasn't been allocated. */
+			UWord base;
+			std::vector<std::unique_ptr<UWord[]>> chunks;
+
+			void allocate(std::unique_ptr<UWord[]> &);
+	};
+}
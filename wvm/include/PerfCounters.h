@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Defs.h"
+
+namespace WVM {
+	/** Cheap hardware-style event counters. Guest code can read any of them by ID with the qc instruction; the IDs are
+	 *  the positions in the list returned by names() and are documented in ISA.md. */
+	struct PerfCounters {
+		/** Instructions retired, indexed by opcode. Opcodes at or past the end of the array aren't valid anyway. */
+		std::array<uint64_t, 128> retired {};
+		uint64_t branchesTaken = 0, branchesNotTaken = 0;
+		uint64_t translations = 0, successfulTranslations = 0;
+		uint64_t pageFaults = 0;
+		/** Delivered interrupts, indexed by InterruptType. */
+		std::array<uint64_t, 8> interrupts {};
+		uint64_t ringTransitions = 0;
+		uint64_t ioBytesRead = 0, ioBytesWritten = 0;
+		/** Host time spent in an execution loop, including time spent resting. */
+		std::chrono::nanoseconds hostRunning {0};
+		/** Host time spent waiting for an interrupt after a rest instruction. */
+		std::chrono::nanoseconds hostIdle {0};
+		/** When the stopwatches currently timing hostRunning and hostIdle were started, or the epoch if there are
+		 *  none, so that reads made while they're running include the time so far. */
+		std::chrono::steady_clock::time_point runningSince {}, idleSince {};
+
+		/** Adds the lifetime of the stopwatch to a duration and marks it as running in the meantime. */
+		class Stopwatch {
+			private:
+				std::chrono::nanoseconds &target;
+				std::chrono::steady_clock::time_point &since;
+
+			public:
+				Stopwatch(std::chrono::nanoseconds &target_, std::chrono::steady_clock::time_point &since_):
+					target(target_), since(since_) { since = std::chrono::steady_clock::now(); }
+				~Stopwatch() {
+					target += std::chrono::steady_clock::now() - since;
+					since = {};
+				}
+		};
+
+		/** Times a rest that outlasts any one stopwatch, as when a session parks a resting VM: the time until
+		 *  endRest() counts as both running and idle. */
+		void beginRest();
+		void endRest();
+
+		inline void retire(int opcode) {
+			if (size_t(opcode) < retired.size())
+				++retired[opcode];
+		}
+
+		inline void branch(bool taken) {
+			++(taken? branchesTaken : branchesNotTaken);
+		}
+
+		/** Returns the value of the counter with a given ID, or 0 if the ID is invalid. */
+		uint64_t get(size_t id) const;
+		void clear();
+
+		/** Returns the name and current value of every counter in ID order. */
+		std::vector<std::pair<std::string, uint64_t>> list() const;
+		static const std::vector<std::string> & names();
+	};
+}
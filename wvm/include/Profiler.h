@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Defs.h"
+
+namespace WVM {
+	class VM;
+
+	/** Counts how many times each instruction in the code section is executed. The counters are a flat array indexed by
+	 *  offset into the code section, so recording a tick is a subtraction, a comparison and an increment. */
+	class Profiler {
+		private:
+			const VM &vm;
+			std::vector<uint64_t> counts;
+			Word base = 0;
+			/** The size of the profiled range in bytes. */
+			UWord limit = 0;
+			/** Instructions executed at addresses outside the code section (e.g., virtual addresses with paging on). */
+			uint64_t outside = 0;
+			bool running = false;
+			std::chrono::steady_clock::time_point startTime;
+			std::chrono::nanoseconds elapsed {0};
+
+		public:
+			Profiler(const VM &vm_): vm(vm_) {}
+
+			/** Starts counting. Counters from a previous session are kept unless clear() is called first. */
+			void start();
+			void stop();
+			void clear();
+			bool isRunning() const { return running; }
+			uint64_t total() const;
+
+			/** Writes the hottest functions and source lines, sorted by self cycles. */
+			void report(std::ostream &, size_t max_rows = 20) const;
+
+			inline void record(Word address) {
+				const UWord offset = address - base;
+				if (offset < limit)
+					++counts[offset / 8];
+				else
+					++outside;
+			}
+	};
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace WVM {
+	/** A bounded lock-free queue for exactly one producer thread and one consumer thread at a time. Slots are
+	 *  default-initialized, so a large ring of a trivial type only takes up memory as far as it's been filled. */
+	template <typename T>
+	class SPSCRing {
+		private:
+			size_t size;
+			std::unique_ptr<T[]> slots;
+			size_t mask;
+			/** The index of the next slot to read. Only written by the consumer. */
+			alignas(64) std::atomic<size_t> head = 0;
+			/** The index of the next slot to write. Only written by the producer. */
+			alignas(64) std::atomic<size_t> tail = 0;
+
+			static size_t roundUp(size_t capacity) {
+				size_t out = 1;
+				while (out < capacity)
+					out <<= 1;
+				return out;
+			}
+
+		public:
+			/** The capacity is rounded up to a power of two. */
+			SPSCRing(size_t capacity): size(roundUp(capacity)), slots(new T[size]), mask(size - 1) {}
+
+			/** Returns false if the ring is full. */
+			bool push(const T &item) {
+				const size_t position = tail.load(std::memory_order_relaxed);
+				if (position - head.load(std::memory_order_acquire) == size)
+					return false;
+				slots[position & mask] = item;
+				tail.store(position + 1, std::memory_order_release);
+				return true;
+			}
+
+			/** Returns false if the ring is empty. */
+			bool pop(T &item) {
+				const size_t position = head.load(std::memory_order_relaxed);
+				if (position == tail.load(std::memory_order_acquire))
+					return false;
+				item = slots[position & mask];
+				head.store(position + 1, std::memory_order_release);
+				return true;
+			}
+
+			bool empty() const {
+				return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+			}
+
+			size_t capacity() const { return size; }
+	};
+}
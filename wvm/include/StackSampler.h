@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "Defs.h"
+
+namespace WVM {
+	class VM;
+
+	/** Periodically captures the guest call stack by walking the $m5 frame chain and counts identical stacks. Samples
+	 *  are taken either every N instructions or whenever a host timer fires, and can be written as folded stacks for
+	 *  flamegraph.pl. */
+	class StackSampler {
+		private:
+			VM &vm;
+			/** Each key is a stack of addresses, outermost frame first. */
+			std::map<std::vector<Word>, uint64_t> stacks;
+			std::vector<Word> scratch;
+			UWord interval = 0;
+			UWord countdown = 0;
+			bool running = false;
+			std::atomic_bool due = false;
+			/** Guarded by timerMutex, so that the timer thread can't miss being told to stop while it waits. */
+			bool timerAlive = false;
+			std::mutex timerMutex;
+			std::condition_variable timerCondition;
+			std::thread timerThread;
+			uint64_t samples = 0;
+
+			void sample();
+			void stopTimer();
+
+		public:
+			/** Guest stacks deeper than this are truncated (and also protects against cycles in the frame chain). */
+			static constexpr size_t MAX_DEPTH = 256;
+			/** The fastest the host timer runs. Anything faster would keep the timer thread busy. */
+			static constexpr UWord MAX_HZ = 10'000;
+
+			StackSampler(VM &vm_): vm(vm_) {}
+			~StackSampler();
+
+			/** Samples once every `instructions` ticks. */
+			void start(UWord instructions);
+			/** Samples whenever a host timer running at the given frequency, at most MAX_HZ, fires. Returns the frequency
+			 *  used. */
+			UWord startTimed(UWord hz);
+			void stop();
+			void clear();
+			bool isRunning() const { return running; }
+			uint64_t getSamples() const { return samples; }
+
+			/** Writes one line per distinct stack: demangled frames separated by semicolons, then the sample count. */
+			void writeFolded(std::ostream &) const;
+
+			inline void tick() {
+				if (interval) {
+					if (--countdown == 0) {
+						countdown = interval;
+						sample();
+					}
+				} else if (due.load(std::memory_order_relaxed)) {
+					due.store(false, std::memory_order_relaxed);
+					sample();
+				}
+			}
+	};
+}
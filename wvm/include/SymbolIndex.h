@@ -0,0 +1,58 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Defs.h"
+#include "Symbol.h"
+
+namespace WVM {
+	/** A flat array of symbols sorted by absolute address, rebuilt whenever the symbol table is loaded. Lookups are
+	 *  binary searches, so symbolizing a PC doesn't require scanning the whole symbol table. */
+	class SymbolIndex {
+		public:
+			struct Entry {
+				Word address;
+				/** The distance to the next symbol or to the end of the symbol's section, whichever is closer. */
+				Word size;
+				/** Points to a key in the VM's symbol table. */
+				const std::string *name;
+
+				Entry(Word address_, Word size_, const std::string *name_):
+					address(address_), size(size_), name(name_) {}
+
+				bool contains(Word other) const { return address <= other && other < address + size; }
+			};
+
+			using const_iterator = std::vector<Entry>::const_iterator;
+
+			void build(const std::map<std::string, Symbol> &, Word code_offset, Word data_offset, Word symbols_offset);
+			void clear();
+
+			/** Returns the symbol at or before the given address, or nullptr if there isn't one. When multiple symbols
+			 *  share an address, ordinary names are preferred over assembler-generated labels. */
+			const Entry * nearest(Word address) const;
+
+			/** Like nearest(), but returns nullptr if the address is past the end of the nearest symbol. */
+			const Entry * find(Word address) const;
+
+			/** Returns the range of all symbols located exactly at the given address. */
+			std::pair<const_iterator, const_iterator> at(Word address) const;
+
+			/** Returns a pointer to the name of the first symbol located exactly at the given address, or nullptr. */
+			const std::string * nameAt(Word address) const;
+
+			const_iterator begin() const { return entries.begin(); }
+			const_iterator end()   const { return entries.end(); }
+			size_t size() const { return entries.size(); }
+			bool empty() const { return entries.empty(); }
+
+			/** Returns whether a symbol name looks like an internal label generated by the assembler. */
+			static bool isInternalLabel(const std::string &);
+
+		private:
+			std::vector<Entry> entries;
+	};
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <atomic>
+#include <bitset>
+#include <chrono>
 #include <condition_variable>
 #include <filesystem>
 #include <functional>
@@ -9,34 +11,75 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "Breakpoint.h"
 #include "Changes.h"
 #include "DebugData.h"
 #include "Defs.h"
+#include "DirtyMap.h"
+#include "Drive.h"
 #include "Interrupts.h"
+#include "Memory.h"
+#include "PageEpochs.h"
 #include "Paging.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
+#include "StackSampler.h"
 #include "Symbol.h"
+#include "SymbolIndex.h"
 #include "Why.h"
 
 namespace WVM {
-	struct Drive {
-		const std::string name;
-		const int fd;
-		Drive(const std::string &name_, int fd_): name(name_), fd(fd_) {}
+	struct Watchpoint {
+		enum Access: UByte {Read = 1, Write = 2, ReadWrite = Read | Write};
+		/** Physical address of the first watched byte. */
+		Word address;
+		Word length;
+		Access access;
+		Watchpoint(Word address_, Word length_, Access access_): address(address_), length(length_), access(access_) {}
 	};
 
 	class VM {
 		private:
-			std::vector<UByte> initial;
+			Memory initial;
 			std::filesystem::path loadedFrom;
 			size_t memorySize;
 			bool keepInitial;
 			std::atomic<bool> active = false;
+			UWord memoryEpoch = 1;
+			/** The epoch in which the program was loaded. Pages with a later epoch may differ from the initial image. */
+			UWord loadEpoch = 1;
+			/** The epoch in which the VM was forked, if it was. Pages with a later epoch may differ from the snapshot its
+			 *  memory shares pages with. */
+			UWord forkEpoch = 0;
+			/** The memory epoch in which each EPOCH_PAGE_SIZE-byte page was last changed. */
+			PageEpochs pageEpochs;
 			size_t cycles = 0;
 			std::unordered_set<Word> breakpoints;
+			/** Conditions and hit counts for the breakpoints that have them. */
+			std::unordered_map<Word, BreakpointRule> breakpointRules;
+			/** Breakpoints used internally for stepping. They're invisible to clients and all of them are removed as
+			 *  soon as execution stops at any breakpoint. */
+			std::unordered_set<Word> temporaryBreakpoints;
+			static constexpr size_t BREAKPOINT_BUCKETS = 4096;
+			/** One bit per bucket of instruction addresses that contains a breakpoint of either kind. tick() only
+			 *  consults the sets when the bit for the new program counter is set, so it costs a single well-predicted
+			 *  branch when there are no breakpoints. */
+			std::bitset<BREAKPOINT_BUCKETS> breakpointFilter;
+			std::vector<Watchpoint> watchpoints;
+			/** The union of the access types of the watchpoints overlapping each page. Empty when there are no
+			 *  watchpoints so that unwatched accesses cost a single branch. */
+			std::vector<UByte> watchedPages;
+			/** Set by checkWatchpoints() during an instruction and acted on by tick() once it has finished. */
+			bool watchTriggered = false;
+			size_t watchHit = 0;
+			Word watchHitAddress = 0, watchHitPC = 0;
+			bool watchHitWrite = false;
 			std::vector<std::vector<std::unique_ptr<Change>>> undoStack;
 			std::vector<std::unique_ptr<Change>> changeBuffer;
 			size_t undoPointer = 0;
@@ -51,7 +94,8 @@ namespace WVM {
 			std::atomic_bool restAcknowledged = false;
 			std::mutex restMutex, restAcknowledgeMutex;
 			std::condition_variable restCondition, restAcknowledgeCondition;
-			std::atomic_bool playThreadAlive = false;
+			/** Whether a thread is blocked in awaitWake(). Only changed with restMutex held. */
+			bool restWaiting = false;
 
 			bool getZ();
 			bool getN();
@@ -61,19 +105,36 @@ namespace WVM {
 			void setN(bool);
 			void setC(bool);
 			void setO(bool);
+			static size_t breakpointBucket(Word address) { return (UWord(address) >> 3) % BREAKPOINT_BUCKETS; }
+			void rebuildBreakpointFilter();
+			bool checkBreakpoint();
+			void rebuildWatchedPages();
+			void checkWatchpoints(Word address, Word length, Watchpoint::Access);
+			/** Printed output not yet passed to onPrint. It's flushed whenever it fills up, so it never grows past
+			 *  OUTPUT_CHUNK_SIZE. */
+			std::string outputBuffer;
+			/** When the first byte in the output buffer was printed. */
+			std::chrono::steady_clock::time_point outputStart;
+			/** Copies the pages changed since loading back from the initial image. */
+			void restoreInitial();
 			static std::chrono::milliseconds getMilliseconds();
-			static std::string demangleLabel(const std::string &str);
 
 		public:
 			static constexpr size_t PAGE_SIZE = 65536;
+			static constexpr size_t EPOCH_PAGE_SIZE = 4096;
+			static constexpr size_t OUTPUT_CHUNK_SIZE = 4096;
+			static constexpr std::chrono::milliseconds OUTPUT_FLUSH_INTERVAL {20};
+
+			static std::string demangleLabel(const std::string &str);
 
-			std::vector<UByte> memory;
+			Memory memory;
 			Ring ring = Ring::Zero;
 			Word programCounter = -1;
 			Word interruptTableAddress = 0;
-			Word registers[Why::totalRegisters];
+			Word registers[Why::totalRegisters] {};
 			std::map<std::string, Symbol> symbolTable;
-			std::multimap<Word, std::string> symbolsByPosition;
+			/** Sorted by address; rebuilt by loadSymbols(). */
+			SymbolIndex symbolIndex;
 			std::map<Word, DebugData> debugMap;
 			std::map<int, const std::string *> debugFiles, debugFunctions;
 			std::vector<Drive> drives;
@@ -94,6 +155,12 @@ namespace WVM {
 			std::list<const std::string *> jumpStack;
 			std::vector<PagingState> pagingStack;
 			UWord timerTicks = 0;
+			PerfCounters counters;
+			/** Words written since the last time a client was sent memory updates. Disabled until a client subscribes
+			 *  to memory. */
+			DirtyMap dirtyWords;
+			Profiler profiler {*this};
+			StackSampler sampler {*this};
 			bool timerActive = false;
 
 			std::function<void(unsigned char)> onRegisterChange = [](unsigned char) {};
@@ -105,9 +172,14 @@ namespace WVM {
 			std::function<void(const std::string &)> onPrint = [](const std::string &) {};
 			std::function<void(Word)> onAddBreakpoint = [](Word) {};
 			std::function<void(Word)> onRemoveBreakpoint = [](Word) {};
+			/** Watchpoint, accessed address, PC of the accessing instruction, whether the access was a write */
+			std::function<void(const Watchpoint &, Word, Word, bool)> onWatchpoint =
+				[](const Watchpoint &, Word, Word, bool) {};
 			std::function<void(bool)> onPagingChange = [](bool) {};
 			std::function<void(Word)> onP0Change = [](Word) {};
 			std::function<void()> onPlayStart = [] {}, onPlayEnd = [] {};
+			/** Called when an interrupt wakes the VM from resting. */
+			std::function<void()> onWake = [] {};
 
 			VM(size_t memory_size, bool keep_initial = true);
 			~VM();
@@ -149,8 +221,20 @@ namespace WVM {
 			bool pause();
 			void wakeRest();
 			void rest();
+			/** Adds printed text to the output buffer, which is passed to onPrint in chunks: when a newline is printed,
+			 *  when OUTPUT_CHUNK_SIZE bytes have built up, when the oldest byte has waited OUTPUT_FLUSH_INTERVAL by the
+			 *  time more is printed and whenever flushOutput() is called. Called by operations with the VM locked. */
+			void print(std::string_view);
+			/** Passes any buffered output to onPrint. Hosts call this when execution stops and every so often while it
+			 *  runs, so that a partial line doesn't wait for the next print. */
+			void flushOutput();
+			/** Blocks while the VM is resting until an interrupt wakes it or the timeout passes. Returns whether the VM
+			 *  is awake. Must be called without the VM's lock held. */
+			bool awaitWake(std::chrono::microseconds timeout);
 			bool undo();
 			bool redo();
+			/** Discards all recorded history. */
+			void clearHistory();
 			bool getActive() const { return active; }
 			bool tick();
 			Word nextInstructionAddress() const;
@@ -158,17 +242,76 @@ namespace WVM {
 			void setTimer(UWord microseconds);
 
 			void addBreakpoint(Word);
+			void addBreakpoint(Word, BreakpointRule &&);
 			void removeBreakpoint(Word);
 			const std::unordered_set<Word> & getBreakpoints() const;
 			bool hasBreakpoint(Word) const;
+			/** Returns nullptr for plain breakpoints. */
+			const BreakpointRule * getBreakpointRule(Word) const;
+			void addTemporaryBreakpoint(Word);
+			void clearTemporaryBreakpoints();
+
+			void addWatchpoint(Word address, Word length, Watchpoint::Access);
+			/** Removes every watchpoint starting at an address and returns whether there were any. */
+			bool removeWatchpoint(Word address);
+			const std::vector<Watchpoint> & getWatchpoints() const { return watchpoints; }
+			/** Called by operations before they read guest data from a physical address. */
+			inline void watchRead(Word address, Word length) {
+				if (!watchedPages.empty())
+					checkWatchpoints(address, length, Watchpoint::Read);
+			}
+			/** Called by operations before they write guest data to a physical address. */
+			inline void watchWrite(Word address, Word length) {
+				if (!watchedPages.empty())
+					checkWatchpoints(address, length, Watchpoint::Write);
+			}
+
+			/** Called whenever guest memory is written, whether by a store or by I/O. */
+			inline void markWritten(Word address, Word length) {
+				dirtyWords.mark(address, length);
+				const UWord last = UWord(address + length - 1) / EPOCH_PAGE_SIZE;
+				for (UWord page = UWord(address) / EPOCH_PAGE_SIZE; page <= last && page < pageEpochs.size(); ++page)
+					pageEpochs.set(page, memoryEpoch);
+			}
+
+			/** Ends the current memory epoch and returns the new one. A client whose copy of memory is current as of
+			 *  this call can later catch up by fetching the pages changed at or after the returned epoch. */
+			UWord beginEpoch() { return ++memoryEpoch; }
+			UWord getEpoch() const { return memoryEpoch; }
+			UWord getLoadEpoch() const { return loadEpoch; }
+			/** Calls the function with the address and length of each run of consecutive pages changed at or after an
+			 *  epoch, in ascending order. */
+			void changedSince(UWord epoch, const std::function<void(Word address, size_t length)> &) const;
+
+			/** Copies of a VM's memory and drives frozen for forking. Any number of forks can share one. */
+			struct Snapshot {
+				Memory memory, initial;
+				std::vector<Drive> drives;
+			};
+
+			/** Takes a snapshot for forkFrom(). Its cost grows with the memory in use rather than with the VM's size. */
+			Snapshot snapshot();
+			/** Turns this VM into a copy of another as of a snapshot of it: registers, the program counter, the ring,
+			 *  paging, breakpoints, watchpoints and the loaded image. Memory shares pages with the snapshot until this
+			 *  VM writes to them, and drives become overlays on the snapshot's. History isn't copied. */
+			void forkFrom(VM &parent, const Snapshot &);
 
 			void load(const std::string &, const std::vector<std::string> &disks = {});
 			void load(const std::filesystem::path &, const std::vector<std::string> &disks = {});
 			void load(std::istream &, const std::vector<std::string> &disks = {});
 			void init();
+			/** Points $g at the end of the image and $sp at the end of memory. */
+			void initRegisters();
+			/** Puts memory, the registers, the program counter, the ring and paging back the way they were right after
+			 *  the program was loaded. Without reload, a VM that keeps its initial memory only restores the pages written
+			 *  since then, so resetting costs little when a run only touches a few pages. */
 			void reset(bool reload = false);
 			void loadSymbols();
 			void loadDebugData();
+			/** Returns the address followed by the demangled name of the nearest symbol and the offset from it. */
+			std::string symbolize(Word address) const;
+			/** Returns the absolute address of a symbol, or -1 if there's no symbol with the given name. */
+			Word symbolAddress(const std::string &name) const;
 
 			size_t getMemorySize() { return memorySize; }
 			std::unique_lock<std::recursive_mutex> lockVM() { return std::unique_lock(mutex); }
@@ -2,16 +2,22 @@
 #define WVM_MODE_CLIENTMODE_H_
 
 #include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include "mode/Mode.h"
 #include "net/Socket.h"
 #include "net/SocketBuffer.h"
+#include "Defs.h"
 
 namespace WVM::Mode {
 	class ClientMode: public Mode {
 		protected:
 			std::optional<Net::Socket> socket;
 			std::optional<Net::SocketBuffer> buffer;
+			/** Whether the server has acknowledged ":Binary on". loop() reads binary frames from then on. */
+			bool binary = false;
 			ClientMode() = default;
 
 		public:
@@ -19,6 +25,20 @@ namespace WVM::Mode {
 			virtual void loop();
 			virtual void stop();
 			virtual void handleMessage(const std::string &) = 0;
+			/** Dispatches a frame's body (starting at its opcode) to the handlers below. */
+			virtual void handleFrame(std::string_view);
+
+			/** By default, typed frames are turned back into the text messages they stand for and passed to
+			 *  handleMessage(), so modes only need to override the ones they care about. */
+			virtual void handleMemoryWord(Word address, Word value, Word pc, UByte size);
+			/** The bytes are little-endian words, exactly as they're stored in the server's memory. */
+			virtual void handleMemoryRun(Word address, std::string_view bytes);
+			virtual void handleRegister(UByte id, Word value);
+			/** By default, each register in the snapshot is passed to handleRegister(). */
+			virtual void handleRegisterSnapshot(const std::vector<std::pair<UByte, Word>> &);
+			virtual void handlePC(Word);
+			/** Receives a chunk of the program's output. */
+			virtual void handleOutput(std::string_view);
 	};
 }
 
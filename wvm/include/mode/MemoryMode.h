@@ -13,6 +13,7 @@
 #include "haunted/ui/Textbox.h"
 #include "haunted/ui/TextInput.h"
 #include "mode/ClientMode.h"
+#include "net/Shared.h"
 #include "VM.h"
 
 namespace WVM::Mode {
@@ -40,8 +41,20 @@ namespace WVM::Mode {
 			std::thread networkThread;
 			std::mutex networkMutex;
 
+			/** When connected to a server on the same host, guest memory and registers are read from its memory files
+			 *  instead of being sent. */
+			std::unique_ptr<Net::SharedState> sharedState;
+			UWord sharedCursor = 0;
+			std::thread sharedThread;
+
 			void startAutotick();
 			void send(const std::string &);
+			/** Subscribes to memory, register and PC updates over the connection. */
+			void subscribe();
+			/** Maps the memory files given in a ":Shared <pid> <memory> <state>" reply. Throws on failure. */
+			void mapShared(const std::vector<std::string> &);
+			/** Applies the shared state's events to the display a few dozen times per second. */
+			void pollShared();
 			void jumpToPC();
 			Haunted::UI::SimpleLine<Container> & getLine(Word address);
 			Haunted::UI::SimpleLine<Container> & addLine(Word address);
@@ -63,6 +76,10 @@ namespace WVM::Mode {
 			void stop() override;
 			void setFastForward(bool);
 			void handleMessage(const std::string &) override;
+			void handleMemoryWord(Word address, Word value, Word pc, UByte size) override;
+			void handleMemoryRun(Word address, std::string_view bytes) override;
+			void handleRegister(UByte id, Word value) override;
+			void handlePC(Word) override;
 			void toggleSearchbox();
 	};
 }
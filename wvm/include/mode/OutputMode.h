@@ -18,6 +18,8 @@ namespace WVM::Mode {
 			void run(const std::string &hostname, int port) override;
 			void stop() override;
 			void handleMessage(const std::string &) override;
+			/** Writes a chunk of output to the terminal as it is. */
+			void handleOutput(std::string_view) override;
 	};
 }
 
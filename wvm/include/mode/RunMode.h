@@ -0,0 +1,35 @@
+#ifndef WVM_MODE_RUNMODE_H_
+#define WVM_MODE_RUNMODE_H_
+
+#include <string>
+#include <vector>
+
+#include "mode/Mode.h"
+#include "VM.h"
+
+namespace WVM::Mode {
+	/** Runs a program to completion without a server or any clients. Output goes straight to stdout. */
+	class RunMode: public Mode {
+		private:
+			/** How many instructions run between flushes of the VM's output buffer. */
+			static constexpr UWord FLUSH_TICKS = 65536;
+
+			VM vm;
+
+		public:
+			static RunMode *instance;
+
+			bool profile = false;
+			/** If nonempty, the call stack is sampled every sampleInterval instructions and written here as folded
+			 *  stacks when the program ends. */
+			std::string foldedPath;
+			UWord sampleInterval = 1000;
+
+			RunMode(): vm(2 * 134'217'728, false) {}
+
+			int run(const std::string &path, const std::vector<std::string> &disks);
+			void stop();
+	};
+}
+
+#endif
@@ -1,48 +1,89 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "mode/Mode.h"
+#include "mode/Session.h"
 #include "net/Server.h"
-#include "VM.h"
 
 namespace WVM::Mode {
+	/** Hosts any number of VMs, one per session. Clients send commands to whichever session they've selected with
+	 *  :Select, or to session 0 (the image the server was started with) if they haven't. Sessions are run by a fixed
+	 *  pool of worker threads in time slices. */
 	class ServerMode: public Mode {
 		private:
+			/** A worker thread and the sessions queued for it. Idle workers steal from the back of other queues. */
+			struct Worker {
+				std::deque<std::shared_ptr<Session>> queue;
+				std::mutex mutex;
+				std::thread thread;
+			};
+
 			Net::Server server;
-			VM vm;
-			std::set<int> memorySubscribers, registerSubscribers, pcSubscribers, outputSubscribers, ffSubscribers,
-			              bpSubscribers, pagingSubscribers, p0Subscribers;
-			std::set<Word> writtenAddresses;
-			bool logMemoryWrites = false, logRegisters = false;
-			std::recursive_mutex subscriberMutex;
 
-			std::atomic_bool readingKeys = true;
-			std::thread keyThread;
-			std::mutex keyMutex;
-			std::deque<UWord> keys;
-			std::unique_lock<std::mutex> lockKeys() { return std::unique_lock(keyMutex); }
+			/** Only locked briefly on its own, since it's also used while the server holds its output lock. */
+			std::mutex sessionMutex;
+			std::map<UWord, std::shared_ptr<Session>> sessions;
+			/** The session each client has selected, for clients that have selected one other than session 0. */
+			std::map<int, UWord> selections;
+			UWord nextSession = 1;
+
+			std::vector<std::unique_ptr<Worker>> workers;
+			std::mutex workMutex;
+			std::condition_variable workCondition;
+			/** The number of sessions in all workers' queues. Only increased with workMutex held, so that waiting workers
+			 *  can't miss it. It can be briefly off by one while a session is being queued or taken. */
+			std::atomic<ptrdiff_t> queued = 0;
+			std::atomic<size_t> nextWorker = 0;
+
+			/** The directory of the image the server was started with. :Create can only load images from in it. */
+			std::filesystem::path imageDirectory;
 
-			void setFastForward(bool);
-			void broadcast(const std::string &);
-			void sendMemory(int);
-			bool tick();
+			std::atomic_bool running = true;
+			std::thread keyThread, statsThread, sampleThread, memoryThread;
 
+			std::shared_ptr<Session> getSession(UWord);
+			std::shared_ptr<Session> selectedSession(int client);
+			std::vector<std::shared_ptr<Session>> allSessions();
+			/** Handles :Create, :Select, :Destroy and :Sessions. */
+			void manage(int client, const std::string &message);
+			/** Resolves an image name given to :Create. Returns an empty path if it's outside the image directory. */
+			std::filesystem::path resolveImage(const std::string &name) const;
+			void work(size_t index);
+			/** Takes a session from a worker's own queue or steals one from another worker's, waiting if there are
+			 *  none. Returns null once the server stops. */
+			std::shared_ptr<Session> takeWork(size_t index);
 
 		public:
+			/** How long a session runs before a worker moves on to the next one queued. */
+			static constexpr std::chrono::milliseconds TIME_SLICE {5};
+
 			static ServerMode *instance;
 
-			ServerMode(int port): server(port, true), vm(2 * 134'217'728) {}
+			ServerMode(int port): server(port, true) {}
 
 			void run(const std::string &path, const std::vector<std::string> &disks);
-			void initVM();
 			void cleanupClient(int);
 			void stop();
 			void handleMessage(int, const std::string &);
-
-			std::unique_lock<std::recursive_mutex> lockSubscribers() { return std::unique_lock(subscriberMutex); }
+			/** Adds a session with a new ID. */
+			std::shared_ptr<Session> createSession();
+			/** Queues a session for a worker. */
+			void schedule(std::shared_ptr<Session>);
+			/** Removes a session and tells the clients that had it selected, and the client that asked if there was
+			 *  one. */
+			void destroySession(UWord, int requester = -1);
+			/** Returns the clients that have a session selected. */
+			std::vector<int> getClients(UWord session);
 	};
 }
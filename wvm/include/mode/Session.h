@@ -0,0 +1,301 @@
+#pragma once
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+
+#include "net/Server.h"
+#include "net/Shared.h"
+#include "SPSCRing.h"
+#include "VM.h"
+
+namespace WVM::Mode {
+	class ServerMode;
+
+	/** A VM hosted by a server, along with the subscriptions clients have made to it. Its commands and runs are
+	 *  executed in time slices by the server's worker threads, never by more than one at a time, so a session with
+	 *  nothing to do doesn't take up a thread. */
+	class Session: public std::enable_shared_from_this<Session> {
+		public:
+			/** The streams events are sent on. When a client's queue is full, each is handled according to the
+			 *  client's overflow policy for it. */
+			enum EventStream: Net::Server::Stream {MemoryStream = 1, PCStream, RegisterStream, OutputStream};
+
+			using Clock = std::chrono::steady_clock;
+
+			/** The most sessions one :Fork can create. */
+			static constexpr UWord MAX_FORKS = 1024;
+			/** How much output can be queued before the worker printing it sends it itself. */
+			static constexpr size_t MAX_QUEUED_OUTPUT = 1 << 20;
+			/** The most bytes of output sent in one message. */
+			static constexpr size_t MAX_OUTPUT_MESSAGE = 65536;
+			/** How many times per second memory is sent to subscribers that don't ask for a rate. */
+			static constexpr UWord DEFAULT_MEMORY_RATE = 30;
+
+			const UWord id;
+			/** Whether the session is queued for a worker or being run by one. Set by whoever queues it. */
+			std::atomic_bool scheduled = false;
+
+			Session(ServerMode &, Net::Server &, UWord id_);
+
+			/** Loads an image and installs the hooks that send the VM's events to subscribers. */
+			void load(const std::string &path, const std::vector<std::string> &disks);
+			/** Has a worker load an image and tell the client ":Created <id>" when it's done. */
+			void create(int client, const std::string &path, const std::vector<std::string> &disks);
+			/** Makes the VM a fork of another session's from a snapshot of it. The fork keeps playing if the parent is.
+			 *  Called by the parent's worker. */
+			void forkFrom(Session &parent, const VM::Snapshot &);
+			/** Queues a message for a worker and makes sure the session is scheduled. */
+			void post(int client, const std::string &message);
+			/** Handles queued commands and continues the current run until the deadline passes. Returns whether
+			 *  there's still something to do. Only called by the worker the session is scheduled on. */
+			bool runSlice(Clock::time_point deadline);
+			/** Whether a message has been queued or a resting VM has been woken since the last slice. */
+			bool runnable() const;
+			/** Stops the session from running again. Workers drop it once their slice ends. */
+			void destroy();
+			void cleanupClient(int);
+
+			/** Sends events queued by workers to subscribers. Called by the event loop on every iteration. */
+			void drainQueued();
+			/** Delivers the next key pressed with :Keybrd, if any. */
+			void deliverKey();
+			/** Sends counter deltas to stats subscribers if they're due. */
+			void flushStats(Clock::time_point now);
+			/** Sends samples to sampling subscribers that are due, unless the session hasn't run since last time. */
+			void sample();
+			/** Sends written memory if it's due and returns when it's due next. */
+			Clock::time_point flushMemoryIfDue(Clock::time_point now);
+			/** Remembers where to resynchronize a client whose memory stream overflowed. Called with the server's output
+			 *  lock held. */
+			void markStale(int client, Net::Server::Stream);
+			/** Sends the current state of a stream to a client that missed updates because its queue was full. */
+			void resume(int client, Net::Server::Stream);
+
+			std::unique_lock<std::recursive_mutex> lockSubscribers() { return std::unique_lock(subscriberMutex); }
+
+		private:
+			ServerMode &host;
+			Net::Server &server;
+			VM vm;
+
+			/** A message from a client waiting to be handled by a worker. */
+			struct Command {
+				int client;
+				std::string message;
+				Command(int client_, const std::string &message_): client(client_), message(message_) {}
+			};
+
+			/** Execution started by :Play, :Tick <n>, :StepOver, :StepOut or :RunTo. Workers run it until a command
+			 *  arrives or their slice ends, handle any commands and then continue it. */
+			struct Run {
+				enum class Kind {Play, Ticks, Until};
+				Kind kind;
+				int client;
+				UWord ticked = 0;
+				/** For Ticks, the number of ticks requested. */
+				UWord ticks = 0;
+				/** For Until, where to stop and how deep the stack has to be. */
+				Word target = 0, minSP = 0;
+				/** For Play, how long to sleep after each tick. */
+				std::chrono::microseconds delay {};
+
+				Run(Kind kind_, int client_): kind(kind_), client(client_) {}
+			};
+
+			/** A register change or jump on a worker, sent to subscribers by the event loop. Trivial, so that the ring of
+			 *  them doesn't take up memory a session never uses. */
+			struct Event {
+				enum class Kind: UByte {Register, PC};
+				Kind kind;
+				UByte id;
+				Word value;
+			};
+
+			/** An image waiting to be loaded by a worker and the client that asked for it. */
+			struct Image {
+				int client;
+				std::string path;
+				std::vector<std::string> disks;
+			};
+
+			std::set<int> memorySubscribers, registerSubscribers, pcSubscribers, outputSubscribers, ffSubscribers,
+			              bpSubscribers, pagingSubscribers, p0Subscribers;
+			/** A subscription to PC or register updates that's sent periodically or when execution stops instead of on
+			 *  every change. Clients subscribed in "every" mode are in pcSubscribers or registerSubscribers instead. */
+			struct Sampling {
+				enum class Mode {Sample, OnPause};
+				Mode mode;
+				Clock::duration interval {};
+				Clock::time_point next {};
+				/** The registers changed since this client's last snapshot. */
+				std::bitset<Why::totalRegisters> changedRegisters;
+				/** The last PC sent to this client. */
+				Word lastPC = -1;
+
+				Sampling(Mode mode_, Clock::duration interval_ = {}): mode(mode_), interval(interval_) {}
+			};
+
+			std::map<int, Sampling> pcSampling, registerSampling;
+			/** The registers changed since the samplers last looked. */
+			std::bitset<Why::totalRegisters> changedRegisters;
+
+			/** A subscription to counter deltas, pushed at an interval of the client's choosing. */
+			struct StatsSubscription {
+				Clock::duration interval;
+				Clock::time_point next {};
+				/** The counters as of the last deltas sent to this client. */
+				std::vector<std::pair<std::string, uint64_t>> previous;
+
+				StatsSubscription(Clock::duration interval_, std::vector<std::pair<std::string, uint64_t>> previous_):
+					interval(interval_), previous(std::move(previous_)) {}
+			};
+
+			std::map<int, StatsSubscription> statsSubscribers;
+
+			/** The epoch begun by the last memory flush that drained anything. Every word the next flush drains was
+			 *  written in it or later. */
+			UWord flushEpoch = 0;
+			/** For clients whose memory stream overflowed, the epoch to resynchronize from once they catch up. Only
+			 *  locked on its own, since it's updated while the server holds its output lock. */
+			std::map<int, UWord> staleMemory;
+			std::mutex staleMutex;
+
+			/** While set, register, memory and PC updates aren't streamed to subscribers. The registers they would have
+			 *  covered are collected instead and sent once by releaseUpdates() along with the dirty memory. */
+			std::atomic_bool holdingUpdates = false;
+			std::bitset<Why::totalRegisters> heldRegisters;
+			bool logMemoryWrites = false, logRegisters = false;
+			std::recursive_mutex subscriberMutex;
+
+			/** Messages for this session are queued here in the order they arrive. */
+			std::deque<Command> commands;
+			std::optional<Image> image;
+			std::mutex commandMutex;
+			/** Set whenever a command is queued so that the current run stops to let the worker handle it. */
+			std::atomic_bool interrupted = false;
+			std::atomic_bool destroyed = false;
+			/** The worker running the session's current slice, if any. */
+			std::atomic<std::thread::id> executorID;
+			/** Commands taken from the queue but not handled yet, because a run their client started with anything
+			 *  other than :Play hasn't finished. Only used by the worker running the session. */
+			std::deque<Command> pending;
+			std::optional<Run> currentRun;
+			/** Set when a slice ends because the VM is resting during :Play. The session isn't scheduled again until
+			 *  an interrupt wakes the VM. */
+			std::atomic_bool parked = false;
+			/** Counts the starts and ends of slices, so that periodic flushes can skip sessions that haven't run since
+			 *  they last looked. */
+			std::atomic<UWord> slices = 0;
+			UWord sampledSlices = 0, memorySlices = 0;
+			std::unique_lock<std::mutex> lockCommands() { return std::unique_lock(commandMutex); }
+
+			/** Events from workers, drained by the event loop. Workers drain it themselves if it's full. */
+			SPSCRing<Event> events {16384};
+			/** Held by whichever thread is draining events. */
+			std::mutex drainMutex;
+			/** Whether the event loop has been woken to drain events and hasn't started yet. */
+			std::atomic_bool wakeRequested = false;
+
+			/** Chunks of output from the VM's output buffer, waiting for the event loop. Whatever builds up between two
+			 *  drains is sent to each subscriber as one message. Only locked on its own. */
+			std::string queuedOutput;
+			std::mutex outputMutex;
+			/** Whether queuedOutput is nonempty, for checks made without the lock. */
+			std::atomic_bool outputQueued = false;
+			std::unique_lock<std::mutex> lockOutput() { return std::unique_lock(outputMutex); }
+
+			/** Created by the first :Shared. Only used with the subscriber lock held. */
+			std::unique_ptr<Net::SharedState> sharedState;
+			/** Whether sharedState exists, for checks made without the lock. */
+			std::atomic_bool sharing = false;
+
+			std::mutex keyMutex;
+			std::deque<UWord> keys;
+			std::atomic<size_t> queuedKeys = 0;
+			std::unique_lock<std::mutex> lockKeys() { return std::unique_lock(keyMutex); }
+
+			/** The rate each memory subscriber asked for. Only used with the subscriber lock held. */
+			std::map<int, UWord> memoryRates;
+			/** How many times per second written memory is sent to memory subscribers while the VM is running: the
+			 *  highest rate any of them asked for. Memory is also sent whenever execution stops. */
+			std::atomic<UWord> memoryRate = DEFAULT_MEMORY_RATE;
+			Clock::time_point lastMemory {};
+
+			void initVM();
+			/** Sets memoryRate from the rates memory subscribers asked for. Called with the subscriber lock held. */
+			void updateMemoryRate();
+			void setFastForward(bool);
+			/** Sends a message to every client that has this session selected. */
+			void broadcast(const std::string &);
+			/** Sends an event to each of the given clients, as a typed frame to clients in binary mode and as text to the
+			 *  rest. Each form is only built if some client needs it. */
+			template <typename T, typename F>
+			void sendEvent(Net::Server::Stream stream, const std::set<int> &clients, const T &make_text,
+			               const F &make_frame) {
+				std::string text, frame;
+				for (int client: clients) {
+					if (server.isBinary(client)) {
+						if (frame.empty())
+							frame = make_frame();
+						server.sendFrame(client, frame, stream);
+					} else {
+						if (text.empty())
+							text = make_text();
+						server.send(client, text, false, stream);
+					}
+				}
+			}
+			/** Sends the whole image, or only the pages changed at or after an epoch if one is given, followed by
+			 *  ":Epoch <epoch>" for the client to pass to ":GetMain since" next time. */
+			void sendMemory(int, UWord since = 0);
+			std::string stringifyMemoryRun(Word address, size_t count);
+			/** Sends every run of memory written since the last flush to memory subscribers as one message each. */
+			void flushMemory();
+			/** Sends the latest PC and a snapshot of the changed registers to sampling subscribers that are due, or to
+			 *  all of them (including those waiting for a pause) if execution has stopped. */
+			void flushSamples(bool stopped);
+			/** Brings every kind of subscriber up to date after execution stops. */
+			void flushStopped();
+			void sendRegisterSnapshot(int client, const std::bitset<Why::totalRegisters> &, Net::Server::Stream);
+			/** Parses "every", "sample <hz>" or "onpause" starting at an index of a split message. Returns false if
+			 *  invalid and leaves sampling empty for "every". */
+			static bool parseSampling(const std::vector<std::string> &, size_t index, std::optional<Sampling> &);
+			static std::string stringifyStats(const std::string &verb, const std::vector<std::pair<std::string, uint64_t>> &);
+			bool tick();
+			void releaseUpdates();
+			/** Schedules the session on a worker unless it's already scheduled. */
+			void wake();
+			/** Handles a message on a worker with the VM locked. */
+			void execute(int client, const std::string &message);
+			/** Returns false and tells the client if a run is already in progress. */
+			bool canStartRun(int client);
+			/** Continues the current run until it ends, a command arrives, the VM rests or the deadline passes. */
+			void continueRun(Clock::time_point deadline);
+			/** Executes one step of the current run and returns whether the run should continue. Until runs execute
+			 *  instructions until execution reaches the target with $sp at or above minSP (so that deeper recursive
+			 *  calls passing through the target don't count) or until the VM stops for some other reason. */
+			bool step(Run &);
+			/** Ends the current run and sends the final state. */
+			void endRun();
+			/** Queues an event from a worker for the event loop. */
+			void publish(const Event &);
+			/** Wakes the event loop to drain events and output unless it's already been woken. */
+			void requestDrain();
+			/** Sends every queued event to subscribers. */
+			void drainEvents();
+			void sendRegister(UByte id, Word value);
+			void sendPC(Word);
+			/** Sends output to subscribers in messages of at most MAX_OUTPUT_MESSAGE bytes: ":Output <hex bytes>" for
+			 *  text clients and Output frames for binary clients. */
+			void sendOutput(std::string_view);
+			/** Returns the address the current function will return to, or -1 if it can't be determined. */
+			Word returnAddress();
+	};
+}
@@ -0,0 +1,49 @@
+#ifndef WVM_NET_BINARY_H_
+#define WVM_NET_BINARY_H_
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Defs.h"
+
+/** The compact framing a client can switch to with ":Binary on". Every frame is a little-endian u32 giving the length
+ *  of the rest of the frame, then an opcode byte, then the opcode's fields, all little-endian. Messages without a
+ *  typed encoding are sent as Text frames containing the same text the text protocol would send, minus the newline.
+ *  Clients keep sending commands as text. */
+namespace WVM::Net::Binary {
+	enum class Opcode: UByte {
+		/** The message as text. */
+		Text = 0,
+		/** u64 address, u64 value, u64 pc, u8 size of the write in bytes (0 if unknown). */
+		MemoryWord = 1,
+		/** u8 register ID, u64 value. */
+		Register = 2,
+		/** u64 program counter. */
+		PC = 3,
+		/** Raw bytes printed by the program. */
+		Output = 4,
+		/** u64 address, then the current contents of a run of memory starting there, as they're stored in memory. */
+		MemoryRun = 5,
+		/** u8 count, then count pairs of u8 register ID and u64 value. */
+		RegisterSnapshot = 6,
+	};
+
+	constexpr size_t LENGTH_SIZE = 4;
+
+	std::string text(std::string_view);
+	std::string memoryWord(UWord address, UWord value, UWord pc, UByte size);
+	std::string registerValue(UByte id, UWord value);
+	std::string pc(UWord);
+	std::string output(std::string_view);
+	std::string memoryRun(UWord address, std::string_view bytes);
+	std::string registerSnapshot(const std::vector<std::pair<UByte, Word>> &);
+
+	/** Reads a little-endian integer from the given offset of a frame. */
+	UWord readU64(std::string_view, size_t offset);
+	UHWord readU32(std::string_view, size_t offset);
+	UByte readU8(std::string_view, size_t offset);
+}
+
+#endif
@@ -1,26 +1,87 @@
 #ifndef WVM_NET_SERVER_H_
 #define WVM_NET_SERVER_H_
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <deque>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <set>
+#include <string>
+#include <string_view>
+#include <thread>
 
 #include <sys/types.h>
 
 namespace WVM::Net {
 	class Server {
+		public:
+			struct Stats {
+				uint64_t messages = 0, bytes = 0;
+				/** The number of system calls made to write output. */
+				uint64_t syscalls = 0;
+				/** The number of system calls writing every message unbuffered would have taken. */
+				uint64_t unbufferedSyscalls = 0;
+				/** Messages discarded because a client's queue was full. */
+				uint64_t dropped = 0;
+			};
+
+			/** Messages are tagged with a stream so that a full queue can be handled differently for each kind of
+			 *  message. Stream 0 is for replies and other messages that are never dropped. */
+			using Stream = uint8_t;
+			static constexpr Stream CONTROL = 0;
+			static constexpr size_t MAX_STREAMS = 8;
+
+			/** What happens to a message on a stream when the client's queue is full. */
+			enum class Overflow: uint8_t {
+				/** The oldest unsent messages on the same stream are discarded to make room. */
+				DropOldest,
+				/** The message and every later one on the stream are discarded and onOverflow is called. Once the
+				 *  queue has drained to half its limit, onResume is called so that the current state can be sent. */
+				Coalesce,
+				/** The client is disconnected. */
+				Disconnect,
+			};
+
 		private:
 			int makeSocket();
 			int port;
+			/** The most that's read from a client at once. Every complete message in what was read is handled before the
+			 *  server waits again, so a burst of commands costs one wakeup instead of one per byte. */
 			size_t chunkSize;
 			char *buffer;
 			int lastClient = -1;
 			int sock = -1;
-			fd_set activeSet;
+			int epollFD = -1;
 			int controlRead = -1, controlWrite = -1;
 			bool connected = false;
 
-			enum class ControlMessage: char {Close='C'};
+			enum class ControlMessage: char {Close='C', Flush='F'};
+
+			struct Message {
+				/** Includes the newline or frame header. */
+				std::string data;
+				Stream stream;
+				Message(std::string &&data_, Stream stream_): data(std::move(data_)), stream(stream_) {}
+			};
+
+			/** Messages waiting to be written to a client. */
+			struct Output {
+				std::deque<Message> messages;
+				/** How much of the first message has already been written. */
+				size_t offset = 0;
+				size_t bytes = 0;
+				/** Messages on streams other than CONTROL aren't queued past this many bytes. */
+				size_t limit = 0;
+				std::array<Overflow, MAX_STREAMS> overflow {};
+				/** Coalescing streams whose messages are being discarded until the queue drains. */
+				std::bitset<MAX_STREAMS> stale;
+				bool disconnecting = false;
+				/** Set when the socket would block. Nothing more is written until epoll reports it writable again. */
+				bool blocked = false;
+			};
 
 			/** Maps client IDs to descriptors. */
 			std::map<int, int> descriptors;
@@ -28,34 +89,89 @@ namespace WVM::Net {
 			/** Maps descriptors to client IDs. */
 			std::map<int, int> clients;
 
-			/** Maps descriptors to buffers. */
+			/** Maps descriptors to the incomplete messages left over from previous reads. */
 			std::map<int, std::string> buffers;
 
 			std::set<int> allClients;
 
+			/** Descriptors of clients that have switched to binary frames. */
+			std::set<int> binaryDescriptors;
+
+			/** Maps descriptors to pending output. send() can be called from any thread, so this and the descriptor
+			 *  maps are guarded by outputMutex. */
+			std::map<int, Output> outputs;
+			std::recursive_mutex outputMutex;
+			std::thread::id loopThread;
+			Stats stats;
+			/** Whether a thread other than the event loop has already asked the loop to wake up and flush. */
+			std::atomic_bool flushRequested = false;
+
+			static constexpr int MAX_EVENTS = 64;
+
+			void acceptClients();
+			/** Drains the control pipe and returns whether the server was asked to close. */
+			bool readControl();
+
+			std::unique_lock<std::recursive_mutex> lockOutput() { return std::unique_lock(outputMutex); }
+			/** Writes as much of a client's pending output as the socket accepts with as few system calls as possible.
+			 *  Returns false if some output is left because the socket would block or already blocked. */
+			bool flush(int descriptor, Output &);
+			void flushAll();
+			void enqueue(int descriptor, std::string &&data, uint64_t unbuffered_syscalls, Stream);
+			/** Applies a stream's overflow policy and returns whether the message should be queued anyway. */
+			bool overflow(int descriptor, Output &, size_t size, Stream);
+			void requestFlush();
+			/** Ends clients marked for disconnection and resumes stale streams of clients that have drained. Called
+			 *  on the event loop thread. */
+			void handleBackpressure();
+
 		public:
 			std::function<void(int, const std::string &)> messageHandler; // (int client, const std::string &message)
 			std::function<void(int, int)> onEnd; // (int client, int descriptor)
 			bool lineMode = false;
+			/** Output for a client is written immediately once at least this many bytes are waiting. Otherwise it's
+			 *  written at the end of the current event loop iteration. */
+			size_t flushThreshold = 65536;
+			/** The queue limit and overflow policies given to new clients. */
+			size_t queueLimit = 16 << 20;
+			std::array<Overflow, MAX_STREAMS> defaultOverflow {};
+			std::function<void(int, Stream)> onOverflow; // (int client, Stream stream), called with the output lock held
+			std::function<void(int, Stream)> onResume; // (int client, Stream stream), called on the event loop thread
+			/** Called on the event loop thread once per iteration, before queued output is written. */
+			std::function<void()> onLoop;
 
-			Server(uint16_t port_, bool line_mode = true, size_t chunk_size = 1);
+			Server(uint16_t port_, bool line_mode = true, size_t chunk_size = 65536);
 			~Server();
 
 			int getPort() const { return port; }
 			void readFromClient(int descriptor);
 			virtual void handleMessage(int client, const std::string &message);
 			virtual void end(int descriptor);
-			void send(int client, const std::string &message, bool suppress_newline = false);
+			/** Sends a text message. Clients in binary mode receive it as a Text frame. */
+			void send(int client, const std::string &message, bool suppress_newline = false, Stream = CONTROL);
+			/** Sends an already encoded binary frame. Only valid for clients in binary mode. */
+			void sendFrame(int client, const std::string &frame, Stream = CONTROL);
+			/** Makes the event loop run another iteration soon. Every call writes to the control pipe, so callers should
+			 *  avoid calling it again before onLoop has run. */
+			void wake();
+			void setQueueLimit(int client, size_t);
+			void setOverflow(int client, Stream, Overflow);
+			/** Output queued after this call is framed (or not) according to the new mode. The acknowledgement, if any,
+			 *  is queued in the old format under the same lock, so that nothing else can come between the two. */
+			void setBinary(int client, bool, const std::string &acknowledgement = "");
+			bool isBinary(int client);
 			void removeClient(int);
 			void run();
 			void stop();
-			const std::set<int> & getClients() const { return allClients; }
+			/** Returns a copy of the set of connected clients, which other threads can change at any time. */
+			std::set<int> getClients();
+			Stats getStats();
 
 			/** Given a buffer, this function returns {-1, *} if the message is still incomplete or the {i, l} if the
 			 *  buffer contains a complete message, where i is the index at which the message ends and l is the size of
 			 *  the delimiter that ended the message. By default, a message is considered complete after the first
 			 *  newline. */
-			virtual std::pair<ssize_t, size_t> isMessageComplete(const std::string &);
+			virtual std::pair<ssize_t, size_t> isMessageComplete(std::string_view);
 	};
 }
 
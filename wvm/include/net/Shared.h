@@ -0,0 +1,100 @@
+#ifndef WVM_NET_SHARED_H_
+#define WVM_NET_SHARED_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "Defs.h"
+#include "Why.h"
+
+namespace WVM::Net {
+	/** State shared with clients on the same host through a memory file: a snapshot of the registers and program
+	 *  counter and a ring of recent events. Guest memory is shared separately through the VM's own memory file. The
+	 *  server is the only writer. Clients map the file read-only, so any number of them can read it without locks and
+	 *  without the server knowing. A client that falls too far behind is told that it lost events and should reread
+	 *  everything it shows. */
+	class SharedState {
+		public:
+			static constexpr uint32_t MAGIC = 0x534d5657; // "WVMS"
+			static constexpr uint32_t VERSION = 1;
+
+			enum class EventType: uint32_t {Register, PC, Memory};
+
+			struct Event {
+				EventType type;
+				/** The register ID for Register and the number of words for Memory. */
+				uint32_t argument;
+				/** The register's value, the program counter or the address of the first word. */
+				Word value;
+			};
+
+			enum class Status {Event, Empty, Lost};
+
+			/** Creates a new memory file for the server to write to. */
+			static std::unique_ptr<SharedState> create(size_t ring_capacity = 4096);
+			/** Maps a memory file created by create() read-only. Throws if it isn't a state file of this version. */
+			static std::unique_ptr<SharedState> view(int descriptor);
+
+			~SharedState();
+
+			SharedState(const SharedState &) = delete;
+			SharedState & operator=(const SharedState &) = delete;
+
+			/** The writing functions can be called from any of the server's threads. */
+			void setRegister(UByte id, Word value);
+			void setPC(Word);
+			void setMemorySize(size_t);
+			void memoryChanged(Word address, size_t count);
+
+			/** Copies a consistent snapshot of the registers and the program counter. */
+			void readSnapshot(Word *registers, Word &pc) const;
+			/** Reads the event at the cursor and advances the cursor past it. After Lost, the cursor is moved to the
+			 *  newest event and the reader should reread everything. */
+			Status next(UWord &cursor, Event &) const;
+			/** Returns the cursor of the next event to be written. */
+			UWord getCursor() const;
+			size_t getMemorySize() const;
+			int getDescriptor() const { return descriptor; }
+
+		private:
+			struct Header {
+				uint32_t magic;
+				uint32_t version;
+				uint64_t capacity;
+				std::atomic<uint64_t> memorySize;
+				/** Odd while the snapshot is being changed. */
+				std::atomic<uint64_t> sequence;
+				std::atomic<Word> programCounter;
+				std::atomic<Word> registers[Why::totalRegisters];
+				/** The number of events written so far. */
+				alignas(64) std::atomic<uint64_t> written;
+			};
+
+			struct Slot {
+				/** Twice the index of the event in the slot, plus one while it's being written. */
+				std::atomic<uint64_t> sequence;
+				/** The event's type and argument packed together. */
+				std::atomic<uint64_t> kind;
+				std::atomic<Word> value;
+			};
+
+			static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared atomics have to be lock-free");
+
+			int descriptor = -1;
+			size_t length = 0;
+			Header *header = nullptr;
+			Slot *slots = nullptr;
+			/** Serializes the server's threads. Readers never lock. */
+			std::mutex writeMutex;
+
+			SharedState() = default;
+			void map(bool writable);
+			void beginSnapshot();
+			void endSnapshot();
+			void push(EventType, uint32_t argument, Word value);
+	};
+}
+
+#endif
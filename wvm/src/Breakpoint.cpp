@@ -0,0 +1,235 @@
+#include <cctype>
+#include <stdexcept>
+
+#include "Breakpoint.h"
+#include "Util.h"
+#include "VM.h"
+#include "Why.h"
+
+namespace WVM {
+	namespace {
+		using Op = BreakCondition::Op;
+
+		class Compiler {
+			private:
+				const std::string &source;
+				const VM &vm;
+				std::vector<std::string> tokens;
+				size_t position = 0;
+				size_t depth = 0;
+
+				void tokenize() {
+					static const char *operators[] {"==", "!=", "<=", ">=", "&&", "||", "<<", ">>"};
+					for (size_t i = 0; i < source.size();) {
+						// Conditions come from the network, so bytes past 0x7f have to be kept out of the <cctype> functions.
+						const unsigned char ch = source[i];
+						if (std::isspace(ch)) {
+							++i;
+						} else if (std::isalnum(ch) || ch == '_' || ch == '$' || ch == '.') {
+							size_t j = i + 1;
+							while (j < source.size() && (std::isalnum(static_cast<unsigned char>(source[j])) || source[j] == '_'
+							       || source[j] == '.'))
+								++j;
+							tokens.push_back(source.substr(i, j - i));
+							i = j;
+						} else {
+							size_t length = 1;
+							for (const char *op: operators)
+								if (source.compare(i, 2, op) == 0)
+									length = 2;
+							if (length == 1 && std::string("<>+-*/%&|^!~()[]").find(ch) == std::string::npos)
+								throw std::runtime_error("Unexpected character in condition: " + std::string(1, char(ch)));
+							tokens.push_back(source.substr(i, length));
+							i += length;
+						}
+					}
+				}
+
+				const std::string & peek() const {
+					static const std::string end;
+					return position < tokens.size()? tokens[position] : end;
+				}
+
+				void expect(const std::string &token) {
+					if (peek() != token)
+						throw std::runtime_error("Expected \"" + token + "\" in condition" +
+							(peek().empty()? "" : " before \"" + peek() + "\""));
+					++position;
+				}
+
+				void emit(Op op, Word operand = 0) {
+					code.emplace_back(op, operand);
+					if (op == Op::Push || op == Op::Register || op == Op::PC) {
+						if (BreakCondition::MAX_DEPTH < ++depth)
+							throw std::runtime_error("Condition is too complex");
+					} else if (Op::Multiply <= op) {
+						--depth;
+					}
+				}
+
+				void primary() {
+					const std::string token = peek();
+					if (token.empty())
+						throw std::runtime_error("Unexpected end of condition");
+					++position;
+
+					if (token == "(") {
+						expression();
+						expect(")");
+					} else if (token == "[") {
+						expression();
+						expect("]");
+						emit(Op::Load);
+					} else if (token == "-" || token == "!" || token == "~") {
+						primary();
+						emit(token == "-"? Op::Negate : token == "!"? Op::Not : Op::Complement);
+					} else if (token.front() == '$') {
+						const int reg = Why::registerID(token);
+						if (reg == -1)
+							throw std::runtime_error("Invalid register in condition: " + token);
+						emit(Op::Register, reg);
+					} else if (std::isdigit(static_cast<unsigned char>(token.front()))) {
+						Word value;
+						if (!Util::parseLong(token, value))
+							throw std::runtime_error("Invalid number in condition: " + token);
+						emit(Op::Push, value);
+					} else if (token == "pc") {
+						emit(Op::PC);
+					} else {
+						const Word address = vm.symbolAddress(token);
+						if (address == -1)
+							throw std::runtime_error("Unknown symbol in condition: " + token);
+						emit(Op::Push, address);
+					}
+				}
+
+				/** Parses a chain of left-associative binary operators at one precedence level. */
+				void binary(size_t level) {
+					static const std::vector<std::vector<std::pair<std::string, Op>>> levels {
+						{{"||", Op::Or}},
+						{{"&&", Op::And}},
+						{{"|", Op::BitOr}},
+						{{"^", Op::BitXor}},
+						{{"&", Op::BitAnd}},
+						{{"==", Op::Equal}, {"!=", Op::NotEqual}},
+						{{"<", Op::Less}, {"<=", Op::LessEqual}, {">", Op::Greater}, {">=", Op::GreaterEqual}},
+						{{"<<", Op::ShiftLeft}, {">>", Op::ShiftRight}},
+						{{"+", Op::Add}, {"-", Op::Subtract}},
+						{{"*", Op::Multiply}, {"/", Op::Divide}, {"%", Op::Modulo}},
+					};
+
+					if (level == levels.size()) {
+						primary();
+						return;
+					}
+
+					binary(level + 1);
+					for (;;) {
+						const std::string &token = peek();
+						bool found = false;
+						for (const auto &[name, op]: levels[level]) {
+							if (token == name) {
+								++position;
+								binary(level + 1);
+								emit(op);
+								found = true;
+								break;
+							}
+						}
+
+						if (!found)
+							return;
+					}
+				}
+
+				void expression() {
+					binary(0);
+				}
+
+			public:
+				std::vector<BreakCondition::Instruction> code;
+
+				Compiler(const std::string &source_, const VM &vm_): source(source_), vm(vm_) {}
+
+				void compile() {
+					tokenize();
+					if (tokens.empty())
+						throw std::runtime_error("Empty condition");
+					expression();
+					if (position != tokens.size())
+						throw std::runtime_error("Unexpected \"" + peek() + "\" in condition");
+				}
+		};
+	}
+
+	BreakCondition BreakCondition::compile(const std::string &source, const VM &vm) {
+		Compiler compiler(source, vm);
+		compiler.compile();
+		return BreakCondition(source, std::move(compiler.code));
+	}
+
+	bool BreakCondition::evaluate(VM &vm) const {
+		Word stack[MAX_DEPTH];
+		size_t top = 0;
+		for (const Instruction &instruction: code) {
+			switch (instruction.op) {
+				case Op::Push:     stack[top++] = instruction.operand; continue;
+				case Op::Register: stack[top++] = vm.registers[instruction.operand]; continue;
+				case Op::PC:       stack[top++] = vm.programCounter; continue;
+				case Op::Load: {
+					bool success;
+					const Word address = vm.translateAddress(stack[top - 1], &success);
+					stack[top - 1] = success && 0 <= address && size_t(address) + 8 <= vm.getMemorySize()?
+						vm.getWord(address) : 0;
+					continue;
+				}
+				case Op::Negate:     stack[top - 1] = -stack[top - 1]; continue;
+				case Op::Not:        stack[top - 1] = !stack[top - 1]; continue;
+				case Op::Complement: stack[top - 1] = ~stack[top - 1]; continue;
+				default: break;
+			}
+
+			const Word right = stack[--top];
+			Word &left = stack[top - 1];
+			switch (instruction.op) {
+				case Op::Multiply:     left *= right; break;
+				// The smallest Word divided by -1 overflows, which traps on x86 instead of wrapping.
+				case Op::Divide:       left = right == 0? 0 : right == -1? Word(-UWord(left)) : left / right; break;
+				case Op::Modulo:       left = right == 0 || right == -1? 0 : left % right; break;
+				case Op::Add:          left += right; break;
+				case Op::Subtract:     left -= right; break;
+				case Op::ShiftLeft:    left = UWord(left) << (right & 63); break;
+				case Op::ShiftRight:   left = UWord(left) >> (right & 63); break;
+				case Op::Less:         left = left <  right; break;
+				case Op::LessEqual:    left = left <= right; break;
+				case Op::Greater:      left = left >  right; break;
+				case Op::GreaterEqual: left = left >= right; break;
+				case Op::Equal:        left = left == right; break;
+				case Op::NotEqual:     left = left != right; break;
+				case Op::BitAnd:       left &= right; break;
+				case Op::BitXor:       left ^= right; break;
+				case Op::BitOr:        left |= right; break;
+				case Op::And:          left = left && right; break;
+				case Op::Or:           left = left || right; break;
+				default: throw std::runtime_error("Invalid breakpoint condition instruction");
+			}
+		}
+
+		return top != 0 && stack[top - 1] != 0;
+	}
+
+	bool BreakpointRule::hit(VM &vm) {
+		if (condition && !condition->evaluate(vm))
+			return false;
+		return after <= ++hits;
+	}
+
+	std::string BreakpointRule::describe() const {
+		std::string out;
+		if (condition)
+			out = "if " + condition->getSource();
+		if (after != 0)
+			out += (out.empty()? "after " : " after ") + std::to_string(after);
+		return out;
+	}
+}
@@ -0,0 +1,59 @@
+#include <algorithm>
+
+#include "DirtyMap.h"
+
+namespace WVM {
+	void DirtyMap::enable(size_t memory_size) {
+		if (!words.empty())
+			return;
+		wordCount = (memory_size + 7) / 8;
+		words.assign(std::max<size_t>(1, (wordCount + 63) / 64), 0);
+		summary.assign((words.size() + 63) / 64, 0);
+	}
+
+	void DirtyMap::disable() {
+		wordCount = 0;
+		words = {};
+		summary = {};
+	}
+
+	void DirtyMap::resize(size_t memory_size) {
+		if (words.empty())
+			return;
+		wordCount = (memory_size + 7) / 8;
+		words.resize(std::max<size_t>(1, (wordCount + 63) / 64));
+		summary.resize((words.size() + 63) / 64);
+		// Marks past the new end would otherwise be drained as out-of-bounds runs.
+		if (wordCount % 64 != 0)
+			words[wordCount / 64] &= (UWord(1) << (wordCount % 64)) - 1;
+		if (words.size() % 64 != 0)
+			summary.back() &= (UWord(1) << (words.size() % 64)) - 1;
+	}
+
+	void DirtyMap::drain(const std::function<void(Word, size_t)> &fn, size_t max_words) {
+		UWord run_start = 0;
+		size_t run_length = 0;
+
+		for (size_t group = 0; group < summary.size(); ++group) {
+			for (UWord group_bits = summary[group]; group_bits != 0; group_bits &= group_bits - 1) {
+				const size_t index = group * 64 + __builtin_ctzll(group_bits);
+				for (UWord bits = words[index]; bits != 0; bits &= bits - 1) {
+					const UWord word = index * 64 + __builtin_ctzll(bits);
+					if (run_length != 0 && run_start + run_length == word && run_length < max_words) {
+						++run_length;
+						continue;
+					}
+					if (run_length != 0)
+						fn(run_start * 8, run_length);
+					run_start = word;
+					run_length = 1;
+				}
+				words[index] = 0;
+			}
+			summary[group] = 0;
+		}
+
+		if (run_length != 0)
+			fn(run_start * 8, run_length);
+	}
+}
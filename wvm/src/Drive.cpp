@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Drive.h"
+
+namespace WVM {
+	namespace {
+		std::runtime_error systemError(const std::string &what) {
+			return std::runtime_error(what + " failed: " + strerror(errno));
+		}
+
+		/** Like pread(2), but keeps reading until the count is reached and fills anything past the end of the file
+		 *  with zeros. */
+		ssize_t readFully(int descriptor, char *buffer, size_t count, off_t offset) {
+			for (size_t done = 0; done < count;) {
+				const ssize_t result = ::pread(descriptor, buffer + done, count - done, offset + done);
+				if (result < 0 && errno == EINTR)
+					continue;
+				if (result < 0)
+					return -1;
+				if (result == 0) {
+					std::memset(buffer + done, 0, count - done);
+					break;
+				}
+				done += result;
+			}
+			return count;
+		}
+
+		bool writeFully(int descriptor, const char *buffer, size_t count, off_t offset) {
+			for (size_t done = 0; done < count;) {
+				const ssize_t result = ::pwrite(descriptor, buffer + done, count - done, offset + done);
+				if (result < 0 && errno == EINTR)
+					continue;
+				if (result <= 0)
+					return false;
+				done += result;
+			}
+			return true;
+		}
+
+		/** Copies the parts of the first length bytes of a file that hold data into another file. Moves the first
+		 *  file's cursor. */
+		void copyData(int from, int to, off_t length) {
+			std::vector<char> buffer(65536);
+			for (off_t start = 0; start < length;) {
+				const off_t data = ::lseek(from, start, SEEK_DATA);
+				if (data == -1)
+					break;
+				off_t hole = ::lseek(from, data, SEEK_HOLE);
+				if (hole == -1 || length < hole)
+					hole = length;
+				for (off_t offset = data; offset < hole;) {
+					const size_t count = std::min<off_t>(buffer.size(), hole - offset);
+					if (readFully(from, buffer.data(), count, offset) == -1 || !writeFully(to, buffer.data(), count, offset))
+						throw systemError("Copying a drive");
+					offset += count;
+				}
+				start = hole;
+			}
+		}
+
+		int createFile() {
+			const int descriptor = ::memfd_create("wvm-drive", MFD_CLOEXEC);
+			if (descriptor == -1)
+				throw systemError("memfd_create()");
+			return descriptor;
+		}
+	}
+
+	Drive::Drive(Drive &&other):
+		name(other.name), descriptor(std::exchange(other.descriptor, -1)), base(std::exchange(other.base, -1)),
+		copied(std::move(other.copied)), cursor(other.cursor), size(other.size) {}
+
+	Drive::~Drive() {
+		if (descriptor != -1 && ::close(descriptor) == -1)
+			std::cerr << "Couldn't close " << name << " (" << descriptor << "): " << strerror(errno) << "\n";
+		if (base != -1)
+			::close(base);
+	}
+
+	off_t Drive::seek(off_t offset, int whence) {
+		if (!isOverlay())
+			return ::lseek(descriptor, offset, whence);
+
+		off_t from;
+		switch (whence) {
+			case SEEK_SET: from = 0;      break;
+			case SEEK_CUR: from = cursor; break;
+			case SEEK_END: from = size;   break;
+			default:
+				errno = EINVAL;
+				return -1;
+		}
+
+		if (from + offset < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		return cursor = from + offset;
+	}
+
+	ssize_t Drive::read(void *buffer, size_t count) {
+		if (!isOverlay())
+			return ::read(descriptor, buffer, count);
+		if (size <= cursor)
+			return 0;
+		const ssize_t result = readAt(buffer, std::min<off_t>(count, size - cursor), cursor);
+		if (0 < result)
+			cursor += result;
+		return result;
+	}
+
+	ssize_t Drive::write(const void *buffer, size_t count) {
+		if (!isOverlay())
+			return ::write(descriptor, buffer, count);
+		const off_t end = cursor + count;
+		if (!copyUp(cursor, end) || !writeFully(descriptor, static_cast<const char *>(buffer), count, cursor))
+			return -1;
+		cursor = end;
+		size = std::max(size, end);
+		return count;
+	}
+
+	Drive Drive::snapshot() const {
+		Drive out(name, createFile());
+		if (isOverlay()) {
+			if (::ftruncate(out.descriptor, size) == -1)
+				throw systemError("ftruncate()");
+			copyData(base, out.descriptor, size);
+			char page[PAGE_SIZE];
+			for (size_t index = 0; index < copied.size(); ++index) {
+				const off_t offset = index * PAGE_SIZE;
+				if (!copied[index] || size <= offset)
+					continue;
+				const size_t count = std::min<off_t>(PAGE_SIZE, size - offset);
+				if (readFully(descriptor, page, count, offset) == -1 || !writeFully(out.descriptor, page, count, offset))
+					throw systemError("Copying a drive");
+			}
+			if (::lseek(out.descriptor, cursor, SEEK_SET) == -1)
+				throw systemError("lseek()");
+		} else {
+			const off_t old_cursor = ::lseek(descriptor, 0, SEEK_CUR);
+			struct stat status;
+			if (old_cursor == -1 || ::fstat(descriptor, &status) == -1)
+				throw systemError("Examining " + name);
+			if (::ftruncate(out.descriptor, status.st_size) == -1)
+				throw systemError("ftruncate()");
+			copyData(descriptor, out.descriptor, status.st_size);
+			// Looking for data moved the guest's cursor.
+			if (::lseek(descriptor, old_cursor, SEEK_SET) == -1 || ::lseek(out.descriptor, old_cursor, SEEK_SET) == -1)
+				throw systemError("lseek()");
+		}
+		return out;
+	}
+
+	Drive Drive::overlay() const {
+		if (isOverlay())
+			throw std::logic_error("Overlays can only be made on snapshots");
+
+		struct stat status;
+		const off_t snapshot_cursor = ::lseek(descriptor, 0, SEEK_CUR);
+		if (snapshot_cursor == -1 || ::fstat(descriptor, &status) == -1)
+			throw systemError("Examining " + name);
+
+		Drive out(name, createFile());
+		out.base = ::dup(descriptor);
+		if (out.base == -1)
+			throw systemError("dup()");
+		out.cursor = snapshot_cursor;
+		out.size = status.st_size;
+		return out;
+	}
+
+	ssize_t Drive::readAt(void *buffer, size_t count, off_t offset) const {
+		char *out = static_cast<char *>(buffer);
+		for (size_t done = 0; done < count;) {
+			const off_t position = offset + done;
+			const size_t index = position / PAGE_SIZE;
+			const size_t chunk = std::min(count - done, PAGE_SIZE - position % PAGE_SIZE);
+			const int from = index < copied.size() && copied[index]? descriptor : base;
+			if (readFully(from, out + done, chunk, position) == -1)
+				return done == 0? -1 : ssize_t(done);
+			done += chunk;
+		}
+		return count;
+	}
+
+	bool Drive::copyUp(off_t start, off_t end) {
+		if (end <= start)
+			return true;
+
+		const size_t last = (end - 1) / PAGE_SIZE;
+		if (copied.size() <= last)
+			copied.resize(last + 1);
+
+		char page[PAGE_SIZE];
+		for (size_t index = start / PAGE_SIZE; index <= last; ++index) {
+			if (copied[index])
+				continue;
+			// The snapshot is never longer than the overlay, so anything past its end is zero.
+			const off_t offset = index * PAGE_SIZE;
+			if (readFully(base, page, PAGE_SIZE, offset) == -1 || !writeFully(descriptor, page, PAGE_SIZE, offset))
+				return false;
+			copied[index] = true;
+		}
+
+		return true;
+	}
+}
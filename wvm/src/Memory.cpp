@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Memory.h"
+
+namespace WVM {
+	namespace {
+		std::runtime_error systemError(const std::string &what) {
+			return std::runtime_error(what + " failed: " + strerror(errno));
+		}
+	}
+
+	Memory::Memory(const Memory &other) {
+		copyFrom(other);
+	}
+
+	Memory::Memory(Memory &&other):
+		descriptor(std::exchange(other.descriptor, -1)), bytes(std::exchange(other.bytes, nullptr)),
+		length(std::exchange(other.length, 0)), writable(other.writable), forked(std::exchange(other.forked, false)) {}
+
+	Memory::~Memory() {
+		unmap();
+		if (descriptor != -1)
+			::close(descriptor);
+	}
+
+	Memory & Memory::operator=(const Memory &other) {
+		if (this != &other)
+			copyFrom(other);
+		return *this;
+	}
+
+	Memory & Memory::operator=(Memory &&other) {
+		if (this != &other) {
+			unmap();
+			if (descriptor != -1)
+				::close(descriptor);
+			descriptor = std::exchange(other.descriptor, -1);
+			bytes = std::exchange(other.bytes, nullptr);
+			length = std::exchange(other.length, 0);
+			writable = other.writable;
+			forked = std::exchange(other.forked, false);
+		}
+		return *this;
+	}
+
+	Memory Memory::view(int descriptor, size_t size) {
+		Memory out;
+		out.descriptor = ::dup(descriptor);
+		if (out.descriptor == -1)
+			throw systemError("dup()");
+		out.writable = false;
+		out.length = size;
+		out.map();
+		return out;
+	}
+
+	Memory Memory::fork() const {
+		if (forked)
+			throw std::logic_error("Forked memory can't be forked again");
+
+		Memory out;
+		if (descriptor == -1)
+			return out;
+		out.descriptor = ::dup(descriptor);
+		if (out.descriptor == -1)
+			throw systemError("dup()");
+		out.forked = true;
+		out.length = length;
+		out.map();
+		return out;
+	}
+
+	void Memory::resize(size_t new_size) {
+		if (new_size == length)
+			return;
+
+		if (forked)
+			throw std::logic_error("Forked memory can't be resized");
+
+		if (descriptor == -1) {
+			descriptor = ::memfd_create("wvm-memory", MFD_CLOEXEC);
+			if (descriptor == -1)
+				throw systemError("memfd_create()");
+		}
+
+		unmap();
+		// A view can only follow the size of a file some other process resizes.
+		if (writable && ::ftruncate(descriptor, new_size) == -1)
+			throw systemError("ftruncate()");
+		length = new_size;
+		map();
+	}
+
+	void Memory::zero() {
+		if (length == 0)
+			return;
+		if (forked) {
+			detach();
+			return;
+		}
+		if (::fallocate(descriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, length) == -1)
+			std::memset(bytes, 0, length);
+	}
+
+	void Memory::map() {
+		if (length == 0)
+			return;
+		void *mapped = ::mmap(nullptr, length, writable? PROT_READ | PROT_WRITE : PROT_READ,
+			(forked? MAP_PRIVATE : MAP_SHARED) | MAP_NORESERVE, descriptor, 0);
+		if (mapped == MAP_FAILED)
+			throw systemError("mmap()");
+		bytes = static_cast<UByte *>(mapped);
+	}
+
+	void Memory::unmap() {
+		if (bytes != nullptr) {
+			::munmap(bytes, length);
+			bytes = nullptr;
+		}
+	}
+
+	void Memory::detach() {
+		unmap();
+		::close(descriptor);
+		descriptor = -1;
+		forked = false;
+		const size_t size = length;
+		length = 0;
+		resize(size);
+	}
+
+	void Memory::copyFrom(const Memory &other) {
+		if (forked)
+			detach();
+		resize(other.length);
+		zero();
+		if (other.descriptor == -1)
+			return;
+
+		// Only the parts of the other file that hold data have to be copied.
+		for (off_t start = 0; start < off_t(length);) {
+			const off_t data = ::lseek(other.descriptor, start, SEEK_DATA);
+			if (data == -1)
+				break;
+			off_t hole = ::lseek(other.descriptor, data, SEEK_HOLE);
+			if (hole == -1 || off_t(length) < hole)
+				hole = length;
+			std::memcpy(bytes + data, other.bytes + data, hole - data);
+			start = hole;
+		}
+	}
+}
@@ -177,6 +177,7 @@ namespace WVM::Operations {
 			case OP_QUERY:
 				switch (funct) {
 					case FN_QM: qmOp(vm, rs, rt, rd, conditions, flags); return;
+					case FN_QC: qcOp(vm, rs, rt, rd, conditions, flags); return;
 				}
 				break;
 			case OP_INTERRUPTS:
@@ -280,6 +281,18 @@ namespace WVM::Operations {
 		address = instr & 0xffffffff;
 	}
 
+	bool isCall(UWord instruction) {
+		instruction = Util::swapEndian(instruction);
+		const int opcode = (instruction >> 52) & 0xfff;
+		if (opcode == OP_J || opcode == OP_JC)
+			return (instruction >> 44) & 1;
+		if (opcode == OP_RJUMP) {
+			const int funct = instruction & 0xfff;
+			return funct == FN_JRL || funct == FN_JRLC;
+		}
+		return false;
+	}
+
 	void setReg(VM &vm, Word &rd, Word value, bool update_flags = true) {
 		if (vm.registerID(rd) == Why::zeroOffset) {
 			std::cerr << "Set register $0 at " << vm.programCounter << "!\n";
@@ -658,13 +671,17 @@ namespace WVM::Operations {
 	}
 
 	void jOp(VM &vm, Word &, bool link, Conditions conditions, int, HWord address) {
-		if (vm.checkConditions(conditions))
+		const bool taken = vm.checkConditions(conditions);
+		if (conditions != Conditions::Disabled)
+			vm.counters.branch(taken);
+		if (taken)
 			vm.jump(address, link);
 		else
 			vm.increment();
 	}
 
 	void jcOp(VM &vm, Word &rs, bool link, Conditions, int, HWord address) {
+		vm.counters.branch(rs != 0);
 		if (rs != 0)
 			vm.jump(address, link);
 		else
@@ -672,7 +689,10 @@ namespace WVM::Operations {
 	}
 
 	void jrOp(VM &vm, Word &, Word &, Word &rd, Conditions conditions, int) {
-		if (vm.checkConditions(conditions)) {
+		const bool taken = vm.checkConditions(conditions);
+		if (conditions != Conditions::Disabled)
+			vm.counters.branch(taken);
+		if (taken) {
 			const auto reg_id = vm.registerID(rd);
 			// Reenable interrupts if jumping to $e0.
 			if (reg_id == Why::exceptionOffset && vm.checkRing(Ring::Zero)) {
@@ -685,6 +705,7 @@ namespace WVM::Operations {
 	}
 
 	void jrcOp(VM &vm, Word &rs, Word &, Word &rd, Conditions, int) {
+		vm.counters.branch(rs != 0);
 		if (rs) {
 			const auto reg_id = vm.registerID(rd);
 			if (reg_id == Why::exceptionOffset && vm.checkRing(Ring::Zero))
@@ -695,13 +716,17 @@ namespace WVM::Operations {
 	}
 
 	void jrlOp(VM &vm, Word &, Word &, Word &rd, Conditions conditions, int) {
-		if (vm.checkConditions(conditions))
+		const bool taken = vm.checkConditions(conditions);
+		if (conditions != Conditions::Disabled)
+			vm.counters.branch(taken);
+		if (taken)
 			vm.jump(rd, true);
 		else
 			vm.increment();
 	}
 
 	void jrlcOp(VM &vm, Word &rs, Word &, Word &rd, Conditions, int) {
+		vm.counters.branch(rs != 0);
 		if (rs) {
 			bool success;
 			const Word translated = vm.translateAddress(rd, &success);
@@ -719,12 +744,14 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated_source, 8);
 			const Word value = vm.getWord(translated_source);
 			const Word translated_destination = vm.translateAddress(rd, &success);
 			if (!success) {
 				vm.intPfault();
 			} else if (vm.checkWritable()) {
 				vm.bufferChange<MemoryChange>(vm, translated_destination, value, Size::Word);
+				vm.watchWrite(translated_destination, 8);
 				vm.setWord(translated_destination, value);
 				vm.increment();
 			} else
@@ -738,6 +765,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 8);
 			setReg(vm, rd, vm.getWord(translated), false);
 			vm.increment();
 		}
@@ -750,6 +778,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Word);
+			vm.watchWrite(translated, 8);
 			vm.setWord(translated, rs);
 			vm.increment();
 		} else
@@ -762,12 +791,14 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated_source, 1);
 			const Byte value = vm.getByte(translated_source);
 			const Word translated_destination = vm.translateAddress(rd, &success);
 			if (!success) {
 				vm.intPfault();
 			} else if (vm.checkWritable()) {
 				vm.bufferChange<MemoryChange>(vm, translated_destination, value, Size::Byte);
+				vm.watchWrite(translated_destination, 1);
 				vm.setByte(translated_destination, value);
 				vm.increment();
 			} else
@@ -781,6 +812,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 1);
 			setReg(vm, rd, vm.getByte(translated), false);
 			vm.increment();
 		}
@@ -793,6 +825,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Byte);
+			vm.watchWrite(translated, 1);
 			vm.setByte(translated, rs);
 			vm.increment();
 		} else
@@ -807,6 +840,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Word);
+			vm.watchWrite(translated, 8);
 			vm.setWord(translated, rs);
 			vm.increment();
 		} else
@@ -819,6 +853,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 8);
 			setReg(vm, rd, vm.getWord(translated), false);
 			setReg(vm, vm.sp(), vm.sp() + 8, false);
 			vm.increment();
@@ -835,18 +870,22 @@ namespace WVM::Operations {
 			switch (immediate) {
 				case 1:
 					vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Byte);
+					vm.watchWrite(translated, 1);
 					vm.setByte(translated, rs);
 					break;
 				case 2:
 					vm.bufferChange<MemoryChange>(vm, translated, rs, Size::QWord);
+					vm.watchWrite(translated, 2);
 					vm.setQuarterword(translated, rs);
 					break;
 				case 4:
 					vm.bufferChange<MemoryChange>(vm, translated, rs, Size::HWord);
+					vm.watchWrite(translated, 4);
 					vm.setHalfword(translated, rs);
 					break;
 				case 8:
 					vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Word);
+					vm.watchWrite(translated, 8);
 					vm.setWord(translated, rs);
 					break;
 				default:
@@ -866,15 +905,19 @@ namespace WVM::Operations {
 		} else {
 			switch (immediate) {
 				case 1:
+					vm.watchRead(translated, 1);
 					setReg(vm, rd, vm.getByte(translated), false);
 					break;
 				case 2:
+					vm.watchRead(translated, 2);
 					setReg(vm, rd, vm.getQuarterword(translated), false);
 					break;
 				case 4:
+					vm.watchRead(translated, 4);
 					setReg(vm, rd, vm.getHalfword(translated), false);
 					break;
 				case 8:
+					vm.watchRead(translated, 8);
 					setReg(vm, rd, vm.getWord(translated), false);
 					break;
 				default:
@@ -892,12 +935,14 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated_source, 4);
 			const HWord value = vm.getHalfword(translated_source);
 			const Word translated_destination = vm.translateAddress(rd, &success);
 			if (!success) {
 				vm.intPfault();
 			} else if (vm.checkWritable()) {
 				vm.bufferChange<MemoryChange>(vm, translated_destination, value, Size::HWord);
+				vm.watchWrite(translated_destination, 4);
 				vm.setHalfword(translated_destination, value);
 				vm.increment();
 			} else
@@ -911,6 +956,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 4);
 			setReg(vm, rd, vm.getHalfword(translated), false);
 			vm.increment();
 		}
@@ -923,6 +969,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::HWord);
+			vm.watchWrite(translated, 4);
 			vm.setHalfword(translated, rs);
 			vm.increment();
 		} else
@@ -939,6 +986,7 @@ namespace WVM::Operations {
 				return;
 			} else if (vm.checkWritable()) {
 				vm.bufferChange<MemoryChange>(vm, translated, rt & 0xff, Size::Byte);
+				vm.watchWrite(translated, 1);
 				vm.setByte(translated, rt & 0xff);
 			} else {
 				vm.intBwrite(translated);
@@ -955,12 +1003,14 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated_source, 2);
 			const QWord value = vm.getQuarterword(translated_source);
 			const Word translated_destination = vm.translateAddress(rd, &success);
 			if (!success) {
 				vm.intPfault();
 			} else if (vm.checkWritable()) {
 				vm.bufferChange<MemoryChange>(vm, translated_destination, value, Size::QWord);
+				vm.watchWrite(translated_destination, 2);
 				vm.setQuarterword(translated_destination, value);
 				vm.increment();
 			} else
@@ -974,6 +1024,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 2);
 			setReg(vm, rd, vm.getQuarterword(translated), false);
 			vm.increment();
 		}
@@ -986,6 +1037,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::QWord);
+			vm.watchWrite(translated, 2);
 			vm.setQuarterword(translated, rs);
 			vm.increment();
 		} else
@@ -1014,6 +1066,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 8);
 			setReg(vm, rd, vm.getWord(translated), false);
 			vm.increment();
 		}
@@ -1026,6 +1079,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Word);
+			vm.watchWrite(translated, 8);
 			vm.setWord(translated, rs);
 			vm.increment();
 		} else
@@ -1044,6 +1098,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Word);
+			vm.watchWrite(translated, 8);
 			vm.setWord(translated, rs);
 			vm.increment();
 		} else
@@ -1056,6 +1111,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 8);
 			setReg(vm, rd, vm.getWord(translated), false);
 			vm.increment();
 		}
@@ -1067,6 +1123,7 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 1);
 			setReg(vm, rd, vm.getByte(translated), false);
 			vm.increment();
 		}
@@ -1079,6 +1136,7 @@ namespace WVM::Operations {
 			vm.intPfault();
 		} else if (vm.checkWritable()) {
 			vm.bufferChange<MemoryChange>(vm, translated, rs, Size::Byte);
+			vm.watchWrite(translated, 1);
 			vm.setByte(translated, rs);
 			vm.increment();
 		} else
@@ -1091,8 +1149,10 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 8);
 			const Word value = vm.getWord(translated);
 			vm.bufferChange<MemoryChange>(vm, rd, value, Size::Word);
+			vm.watchWrite(rd, 8);
 			vm.setWord(rd, value);
 			vm.increment();
 		}
@@ -1104,8 +1164,10 @@ namespace WVM::Operations {
 		if (!success) {
 			vm.intPfault();
 		} else {
+			vm.watchRead(translated, 1);
 			const Byte value = vm.getByte(translated);
 			vm.bufferChange<MemoryChange>(vm, rd, value, Size::Byte);
+			vm.watchWrite(rd, 1);
 			vm.setByte(rd, value);
 			vm.increment();
 		}
@@ -1196,19 +1258,20 @@ namespace WVM::Operations {
 	}
 
 	void prcOp(VM &vm, Word &rs, Word &, Word &, Conditions, int) {
-		vm.onPrint(std::string(1, static_cast<char>(rs)));
+		const char ch = static_cast<char>(rs);
+		vm.print({&ch, 1});
 		vm.increment();
 	}
 
 	void prdOp(VM &vm, Word &rs, Word &, Word &, Conditions, int) {
-		vm.onPrint(std::to_string(rs));
+		vm.print(std::to_string(rs));
 		vm.increment();
 	}
 
 	void prxOp(VM &vm, Word &rs, Word &, Word &, Conditions, int) {
 		std::stringstream ss;
 		ss << std::hex << rs;
-		vm.onPrint(ss.str());
+		vm.print(ss.str());
 		vm.increment();
 	}
 
@@ -1220,7 +1283,7 @@ namespace WVM::Operations {
 	void prbOp(VM &vm, Word &rs, Word &, Word &, Conditions, int) {
 		std::stringstream ss;
 		ss << std::bitset<64>(rs);
-		vm.onPrint(ss.str());
+		vm.print(ss.str());
 		vm.increment();
 	}
 
@@ -1249,7 +1312,7 @@ namespace WVM::Operations {
 				case IO_SEEKABS:
 					if (!valid_id)
 						setReg(vm, e0, 1, false);
-					else if (lseek(vm.drives.at(device_id).fd, a2, SEEK_SET) == -1)
+					else if (vm.drives.at(device_id).seek(a2, SEEK_SET) == -1)
 						setReg(vm, e0, 2, false);
 					else
 						setReg(vm, e0, 0, false);
@@ -1259,7 +1322,7 @@ namespace WVM::Operations {
 					if (!valid_id) {
 						setReg(vm, e0, 1, false);
 					} else {
-						const ssize_t result = lseek(vm.drives.at(device_id).fd, a2, SEEK_CUR);
+						const ssize_t result = vm.drives.at(device_id).seek(a2, SEEK_CUR);
 						if (result == -1) {
 							setReg(vm, e0, 2, false);
 						} else {
@@ -1275,7 +1338,7 @@ namespace WVM::Operations {
 						setReg(vm, e0, 1, false);
 					} else {
 						size_t address = a2, remaining = a3, total_bytes_read = 0;
-						const int fd = vm.drives.at(device_id).fd;
+						Drive &drive = vm.drives.at(device_id);
 						const size_t memsize = vm.getMemorySize();
 						setReg(vm, e0, 0, false);
 
@@ -1305,7 +1368,10 @@ namespace WVM::Operations {
 							}
 
 							const size_t to_read = std::min(mod? mod : VM::PAGE_SIZE, remaining); // And this.
-							const ssize_t bytes_read = ::read(fd, &vm.memory[translated], to_read);
+							vm.watchWrite(translated, to_read);
+							const ssize_t bytes_read = drive.read(&vm.memory[translated], to_read);
+							if (0 < bytes_read)
+								vm.markWritten(translated, bytes_read);
 
 							if (bytes_read < 0)
 								setReg(vm, e0, errno + 3, false);
@@ -1316,6 +1382,7 @@ namespace WVM::Operations {
 							total_bytes_read += size_t(bytes_read);
 						}
 
+						vm.counters.ioBytesRead += total_bytes_read;
 						setReg(vm, r0, total_bytes_read, false);
 					}
 
@@ -1327,7 +1394,7 @@ namespace WVM::Operations {
 						setReg(vm, e0, 1, false);
 					} else {
 						size_t address = a2, remaining = a3, total_bytes_written = 0;
-						const int fd = vm.drives.at(device_id).fd;
+						Drive &drive = vm.drives.at(device_id);
 						const size_t memsize = vm.getMemorySize();
 						setReg(vm, e0, 0, false);
 
@@ -1351,7 +1418,8 @@ namespace WVM::Operations {
 							}
 
 							const size_t to_write = std::min(mod? mod : VM::PAGE_SIZE, remaining); // And this.
-							const ssize_t bytes_written = ::write(fd, &vm.memory[translated], to_write);
+							vm.watchRead(translated, to_write);
+							const ssize_t bytes_written = drive.write(&vm.memory[translated], to_write);
 
 							if (bytes_written < 0)
 								setReg(vm, e0, errno + 2, false);
@@ -1362,6 +1430,7 @@ namespace WVM::Operations {
 							total_bytes_written += size_t(bytes_written);
 						}
 
+						vm.counters.ioBytesWritten += total_bytes_written;
 						setReg(vm, r0, total_bytes_written, false);
 					}
 
@@ -1372,14 +1441,14 @@ namespace WVM::Operations {
 					if (!valid_id) {
 						setReg(vm, e0, 1, false);
 					} else {
-						const int fd = vm.drives.at(device_id).fd;
-						const off_t old_cursor = lseek(fd, 0, SEEK_CUR);
+						Drive &drive = vm.drives.at(device_id);
+						const off_t old_cursor = drive.seek(0, SEEK_CUR);
 						if (old_cursor == -1) {
 							setReg(vm, e0, errno + 1, false);
 							break;
 						}
 
-						const off_t end_cursor = lseek(fd, 0, SEEK_END);
+						const off_t end_cursor = drive.seek(0, SEEK_END);
 						if (end_cursor == -1) {
 							setReg(vm, e0, errno + 1, false);
 							break;
@@ -1387,7 +1456,7 @@ namespace WVM::Operations {
 
 						setReg(vm, r0, Word(end_cursor), false);
 
-						const off_t result = lseek(fd, old_cursor, SEEK_SET);
+						const off_t result = drive.seek(old_cursor, SEEK_SET);
 						setReg(vm, e0, result == -1? errno + 1 : 0, false);
 					}
 
@@ -1398,7 +1467,7 @@ namespace WVM::Operations {
 					if (!valid_id) {
 						setReg(vm, e0, 1, false);
 					} else {
-						const off_t cursor = lseek(vm.drives.at(device_id).fd, 0, SEEK_CUR);
+						const off_t cursor = vm.drives.at(device_id).seek(0, SEEK_CUR);
 						setReg(vm, e0, cursor == -1? errno + 1 : 0, false);
 						if (cursor != -1)
 							setReg(vm, r0, cursor, false);
@@ -1442,7 +1511,9 @@ namespace WVM::Operations {
 							}
 
 							const size_t to_read = std::min(mod? mod : VM::PAGE_SIZE, remaining);
+							vm.watchWrite(translated, to_read);
 							std::memcpy(&vm.memory[translated], c_str + total_bytes_read, to_read);
+							vm.markWritten(translated, to_read);
 
 							remaining -= to_read;
 							address += to_read;
@@ -1554,6 +1625,11 @@ namespace WVM::Operations {
 		vm.increment();
 	}
 
+	void qcOp(VM &vm, Word &rs, Word &, Word &rd, Conditions, int) {
+		setReg(vm, rd, vm.counters.get(rs), false);
+		vm.increment();
+	}
+
 	void diOp(VM &vm, Word &, Word &, Word &, Conditions, int) {
 		if (vm.checkRing(Ring::Zero)) {
 			vm.hardwareInterruptsEnabled = false;
@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "PageEpochs.h"
+
+namespace WVM {
+	PageEpochs::PageEpochs(size_t page_count, UWord epoch):
+		pageCount(page_count), base(epoch), chunks((page_count + CHUNK_PAGES - 1) / CHUNK_PAGES) {}
+
+	PageEpochs::PageEpochs(const PageEpochs &other):
+		pageCount(other.pageCount), base(other.base), chunks(other.chunks.size()) {
+		for (size_t index = 0; index < chunks.size(); ++index)
+			if (other.chunks[index]) {
+				chunks[index] = std::make_unique<UWord[]>(CHUNK_PAGES);
+				std::copy_n(other.chunks[index].get(), CHUNK_PAGES, chunks[index].get());
+			}
+	}
+
+	PageEpochs & PageEpochs::operator=(const PageEpochs &other) {
+		if (this != &other)
+			*this = PageEpochs(other);
+		return *this;
+	}
+
+	UWord PageEpochs::get(size_t page) const {
+		const std::unique_ptr<UWord[]> &chunk = chunks[page / CHUNK_PAGES];
+		return chunk? chunk[page % CHUNK_PAGES] : base;
+	}
+
+	void PageEpochs::fill(UWord epoch) {
+		base = epoch;
+		for (std::unique_ptr<UWord[]> &chunk: chunks)
+			chunk.reset();
+	}
+
+	void PageEpochs::resize(size_t page_count, UWord epoch) {
+		const size_t old_count = pageCount;
+		pageCount = page_count;
+		chunks.resize((page_count + CHUNK_PAGES - 1) / CHUNK_PAGES);
+		if (epoch != base)
+			for (size_t page = old_count; page < page_count; ++page)
+				set(page, epoch);
+	}
+
+	void PageEpochs::replace(UWord after, UWord epoch) {
+		for (std::unique_ptr<UWord[]> &chunk: chunks)
+			if (chunk)
+				std::replace_if(chunk.get(), chunk.get() + CHUNK_PAGES, [after](UWord page) { return after < page; }, epoch);
+		// Unallocated chunks follow the base.
+		if (after < base)
+			base = epoch;
+	}
+
+	void PageEpochs::forEachRun(UWord since, const std::function<void(size_t, size_t)> &fn) const {
+		size_t first = 0, count = 0;
+		for (size_t index = 0; index < chunks.size(); ++index) {
+			const UWord *chunk = chunks[index].get();
+			if (!chunk && base < since) {
+				if (count != 0) {
+					fn(first, count);
+					count = 0;
+				}
+				continue;
+			}
+			const size_t start = index * CHUNK_PAGES, end = std::min(start + CHUNK_PAGES, pageCount);
+			for (size_t page = start; page < end; ++page) {
+				if (since <= (chunk? chunk[page - start] : base)) {
+					if (count++ == 0)
+						first = page;
+				} else if (count != 0) {
+					fn(first, count);
+					count = 0;
+				}
+			}
+		}
+		if (count != 0)
+			fn(first, count);
+	}
+
+	void PageEpochs::allocate(std::unique_ptr<UWord[]> &chunk) {
+		chunk = std::make_unique<UWord[]>(CHUNK_PAGES);
+		std::fill_n(chunk.get(), CHUNK_PAGES, base);
+	}
+}
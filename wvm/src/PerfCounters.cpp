@@ -0,0 +1,103 @@
+#include <numeric>
+
+#include "Operations.h"
+#include "PerfCounters.h"
+
+namespace WVM {
+	namespace {
+		/** Returns a duration plus the time so far of the stopwatch timing it, if one is running. */
+		std::chrono::nanoseconds live(std::chrono::nanoseconds total, std::chrono::steady_clock::time_point since,
+		                              std::chrono::steady_clock::time_point now) {
+			return since == std::chrono::steady_clock::time_point()? total : total + (now - since);
+		}
+
+		uint64_t sum(const std::array<uint64_t, 128> &retired, std::initializer_list<int> opcodes) {
+			uint64_t out = 0;
+			for (const int opcode: opcodes)
+				out += retired[opcode];
+			return out;
+		}
+
+		uint64_t sum(const std::array<uint64_t, 128> &retired, const std::set<int> &opcodes) {
+			uint64_t out = 0;
+			for (const int opcode: opcodes)
+				if (size_t(opcode) < retired.size())
+					out += retired[opcode];
+			return out;
+		}
+	}
+
+	const std::vector<std::string> & PerfCounters::names() {
+		static const std::vector<std::string> out {
+			"retired", "rtype", "itype", "jtype", "memory", "jumps", "ext", "taken", "nottaken", "translations",
+			"translationfailures", "pagefaults", "interrupts", "int.system", "int.timer", "int.protec", "int.pfault",
+			"int.inexec", "int.bwrite", "int.keybrd", "rings", "ioread", "iowritten", "hostexec", "hostidle",
+		};
+		return out;
+	}
+
+	uint64_t PerfCounters::get(size_t id) const {
+		switch (id) {
+			case 0: return std::accumulate(retired.begin(), retired.end(), uint64_t(0));
+			case 1: return sum(retired, Operations::RSet);
+			case 2: return sum(retired, Operations::ISet);
+			case 3: return sum(retired, Operations::JSet);
+			case 4: return sum(retired, {OP_RMEM, OP_LI, OP_SI, OP_LBI, OP_SBI, OP_LNI, OP_LBNI, OP_SSPUSH, OP_SSPOP,
+			                             OP_SPS, OP_SPL});
+			case 5: return sum(retired, {OP_J, OP_JC, OP_RJUMP});
+			case 6: return retired[OP_REXT];
+			case 7: return branchesTaken;
+			case 8: return branchesNotTaken;
+			case 9: return translations;
+			case 10: return translations - successfulTranslations;
+			case 11: return pageFaults;
+			case 12: return std::accumulate(interrupts.begin(), interrupts.end(), uint64_t(0));
+			case 13: case 14: case 15: case 16: case 17: case 18: case 19:
+				return interrupts[id - 12];
+			case 20: return ringTransitions;
+			case 21: return ioBytesRead;
+			case 22: return ioBytesWritten;
+			case 23: case 24: {
+				const auto now = std::chrono::steady_clock::now();
+				const auto running = live(hostRunning, runningSince, now), idle = live(hostIdle, idleSince, now);
+				if (id == 24)
+					return idle.count();
+				return idle < running? (running - idle).count() : 0;
+			}
+			default: return 0;
+		}
+	}
+
+	void PerfCounters::clear() {
+		// Running stopwatches carry on from the moment of clearing.
+		const auto now = std::chrono::steady_clock::now(), epoch = std::chrono::steady_clock::time_point();
+		const bool running = runningSince != epoch, idle = idleSince != epoch;
+		*this = PerfCounters();
+		if (running)
+			runningSince = now;
+		if (idle)
+			idleSince = now;
+	}
+
+	void PerfCounters::beginRest() {
+		runningSince = idleSince = std::chrono::steady_clock::now();
+	}
+
+	void PerfCounters::endRest() {
+		const auto now = std::chrono::steady_clock::now(), epoch = std::chrono::steady_clock::time_point();
+		if (runningSince != epoch)
+			hostRunning += now - runningSince;
+		if (idleSince != epoch)
+			hostIdle += now - idleSince;
+		runningSince = idleSince = epoch;
+	}
+
+	std::vector<std::pair<std::string, uint64_t>> PerfCounters::list() const {
+		const auto &all_names = names();
+		std::vector<std::pair<std::string, uint64_t>> out;
+		out.reserve(all_names.size());
+		for (size_t id = 0; id < all_names.size(); ++id)
+			out.emplace_back(all_names[id], get(id));
+		return out;
+	}
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include "Profiler.h"
+#include "VM.h"
+
+namespace WVM {
+	void Profiler::start() {
+		if (running)
+			return;
+
+		const Word new_base = vm.codeOffset;
+		const UWord new_limit = vm.codeOffset < vm.dataOffset? vm.dataOffset - vm.codeOffset : 0;
+		if (new_base != base || new_limit != limit) {
+			base = new_base;
+			limit = new_limit;
+			counts.assign(limit / 8 + 1, 0);
+			outside = 0;
+			elapsed = {};
+		}
+
+		running = true;
+		startTime = std::chrono::steady_clock::now();
+	}
+
+	void Profiler::stop() {
+		if (!running)
+			return;
+		running = false;
+		elapsed += std::chrono::steady_clock::now() - startTime;
+	}
+
+	void Profiler::clear() {
+		std::fill(counts.begin(), counts.end(), 0);
+		outside = 0;
+		elapsed = {};
+		if (running)
+			startTime = std::chrono::steady_clock::now();
+	}
+
+	uint64_t Profiler::total() const {
+		return std::accumulate(counts.begin(), counts.end(), outside);
+	}
+
+	void Profiler::report(std::ostream &stream, size_t max_rows) const {
+		const uint64_t sum = total();
+		auto nanoseconds = elapsed;
+		if (running)
+			nanoseconds += std::chrono::steady_clock::now() - startTime;
+
+		stream << "Profile: " << sum << " instruction" << (sum == 1? "" : "s") << " in "
+		       << std::chrono::duration_cast<std::chrono::milliseconds>(nanoseconds).count() << " ms";
+		if (outside)
+			stream << " (" << outside << " outside the code section)";
+		stream << '\n';
+
+		if (sum == 0)
+			return;
+
+		std::unordered_map<const SymbolIndex::Entry *, std::string> demangled;
+		std::map<std::string, uint64_t> by_symbol;
+		// Keyed by file and line; the function name is kept alongside for display.
+		std::map<std::pair<const std::string *, int>, std::pair<uint64_t, const std::string *>> by_line;
+
+		for (size_t i = 0; i < counts.size(); ++i) {
+			const uint64_t count = counts[i];
+			if (count == 0)
+				continue;
+
+			const Word address = base + i * 8;
+			const SymbolIndex::Entry *entry = vm.symbolIndex.nearest(address);
+			if (entry) {
+				auto iter = demangled.find(entry);
+				if (iter == demangled.end())
+					iter = demangled.emplace(entry, VM::demangleLabel(*entry->name)).first;
+				by_symbol[iter->second] += count;
+			} else
+				by_symbol["[unknown]"] += count;
+
+			auto debug = vm.debugMap.find(address);
+			if (debug != vm.debugMap.end()) {
+				auto &pair = by_line[{debug->second.file, debug->second.line}];
+				pair.first += count;
+				pair.second = debug->second.function;
+			}
+		}
+
+		auto percent = [sum](uint64_t count) {
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << (100.0 * count / sum) << '%';
+			return ss.str();
+		};
+
+		std::vector<std::pair<std::string, uint64_t>> symbols(by_symbol.begin(), by_symbol.end());
+		std::stable_sort(symbols.begin(), symbols.end(), [](const auto &left, const auto &right) {
+			return left.second > right.second;
+		});
+
+		stream << "\nBy symbol:\n" << std::setw(16) << "Self" << std::setw(9) << "%" << "  Symbol\n";
+		for (size_t i = 0; i < symbols.size() && i < max_rows; ++i)
+			stream << std::setw(16) << symbols[i].second << std::setw(9) << percent(symbols[i].second) << "  "
+			       << symbols[i].first << '\n';
+
+		if (by_line.empty())
+			return;
+
+		using LineRow = std::tuple<const std::string *, int, uint64_t, const std::string *>;
+		std::vector<LineRow> lines;
+		lines.reserve(by_line.size());
+		for (const auto &[key, value]: by_line)
+			lines.emplace_back(key.first, key.second, value.first, value.second);
+		std::stable_sort(lines.begin(), lines.end(), [](const LineRow &left, const LineRow &right) {
+			return std::get<2>(left) > std::get<2>(right);
+		});
+
+		stream << "\nBy line:\n" << std::setw(16) << "Self" << std::setw(9) << "%" << "  Line\n";
+		for (size_t i = 0; i < lines.size() && i < max_rows; ++i) {
+			const auto &[file, line, count, function] = lines[i];
+			stream << std::setw(16) << count << std::setw(9) << percent(count) << "  " << *file << ':' << line;
+			if (function)
+				stream << " (" << *function << ')';
+			stream << '\n';
+		}
+	}
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "StackSampler.h"
+#include "VM.h"
+#include "Why.h"
+
+namespace WVM {
+	StackSampler::~StackSampler() {
+		stopTimer();
+	}
+
+	void StackSampler::start(UWord instructions) {
+		stopTimer();
+		interval = countdown = std::max<UWord>(instructions, 1);
+		running = true;
+	}
+
+	UWord StackSampler::startTimed(UWord hz) {
+		stopTimer();
+		hz = std::clamp<UWord>(hz, 1, MAX_HZ);
+		interval = 0;
+		due = false;
+		running = true;
+		timerAlive = true;
+		const std::chrono::microseconds period(1'000'000 / hz);
+		timerThread = std::thread([this, period] {
+			// Waiting on the condition instead of sleeping lets stopTimer() end the thread without waiting out a period.
+			std::unique_lock lock(timerMutex);
+			while (!timerCondition.wait_for(lock, period, [this] { return !timerAlive; }))
+				due.store(true, std::memory_order_relaxed);
+		});
+		return hz;
+	}
+
+	void StackSampler::stop() {
+		stopTimer();
+		running = false;
+	}
+
+	void StackSampler::stopTimer() {
+		{
+			std::unique_lock lock(timerMutex);
+			if (!timerAlive)
+				return;
+			timerAlive = false;
+		}
+		timerCondition.notify_all();
+		if (timerThread.joinable())
+			timerThread.join();
+	}
+
+	void StackSampler::clear() {
+		stacks.clear();
+		samples = 0;
+	}
+
+	void StackSampler::sample() {
+		// Symbols are aggregated by the start of the nearest symbol so that every sample within a function lands in the
+		// same frame. Addresses without a symbol are kept as-is.
+		auto function = [this](Word address) {
+			const SymbolIndex::Entry *entry = vm.symbolIndex.nearest(address);
+			return entry? entry->address : address;
+		};
+
+		scratch.clear();
+		scratch.push_back(function(vm.programCounter));
+
+		Word m5 = vm.registers[Why::assemblerOffset + 5];
+		bool first = true;
+		auto check_rt = [&](Word return_address, bool have_return_address) {
+			// A leaf function might not have pushed a frame, in which case its caller is only visible through $rt.
+			// A stale $rt left over from an earlier call in the current function points back into the current
+			// function, so it's ignored.
+			const Word rt = vm.rt();
+			if ((!have_return_address || rt != return_address) && function(rt) != scratch.front())
+				scratch.push_back(function(rt));
+			first = false;
+		};
+
+		const size_t memory_size = vm.getMemorySize();
+		while (m5 != 0 && scratch.size() < MAX_DEPTH) {
+			bool success;
+			const Word rt_addr = vm.translateAddress(m5 + 16, &success);
+			if (!success || memory_size < size_t(rt_addr) + 8)
+				break;
+			const Word return_address = vm.getWord(rt_addr);
+			if (first)
+				check_rt(return_address, true);
+			scratch.push_back(function(return_address));
+			const Word m5_addr = vm.translateAddress(m5, &success);
+			if (!success || memory_size < size_t(m5_addr) + 8)
+				break;
+			m5 = vm.getWord(m5_addr);
+		}
+
+		if (first)
+			check_rt(0, false);
+
+		std::reverse(scratch.begin(), scratch.end());
+		++stacks[scratch];
+		++samples;
+	}
+
+	void StackSampler::writeFolded(std::ostream &stream) const {
+		std::unordered_map<Word, std::string> names;
+		auto name = [&](Word address) -> const std::string & {
+			auto iter = names.find(address);
+			if (iter != names.end())
+				return iter->second;
+			std::string out;
+			if (const std::string *symbol = vm.symbolIndex.nameAt(address)) {
+				out = VM::demangleLabel(*symbol);
+				// Semicolons separate frames in the folded format.
+				std::replace(out.begin(), out.end(), ';', ':');
+			} else {
+				std::stringstream ss;
+				ss << "0x" << std::hex << address;
+				out = ss.str();
+			}
+			return names.emplace(address, std::move(out)).first->second;
+		};
+
+		// Different stacks of addresses can produce the same names (e.g., two labels within one function).
+		std::map<std::string, uint64_t> folded;
+		for (const auto &[stack, count]: stacks) {
+			std::string line;
+			for (const Word address: stack) {
+				if (!line.empty())
+					line += ';';
+				line += name(address);
+			}
+			folded[line] += count;
+		}
+
+		for (const auto &[line, count]: folded)
+			stream << line << ' ' << count << '\n';
+	}
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cctype>
+
+#include "SymbolIndex.h"
+
+namespace WVM {
+	void SymbolIndex::build(const std::map<std::string, Symbol> &table, Word code_offset, Word data_offset,
+	                        Word symbols_offset) {
+		entries.clear();
+		entries.reserve(table.size());
+
+		// Until the sizes are computed below, each entry's size field holds the end of its section (or -1) so that the
+		// last symbol in a section doesn't appear to span the start of the next one.
+		for (const auto &[name, symbol]: table) {
+			Word address = symbol.location, limit = -1;
+			switch (symbol.type) {
+				case SymbolEnum::Unknown:
+					continue;
+				case SymbolEnum::Code:
+					address += code_offset;
+					limit = data_offset;
+					break;
+				case SymbolEnum::Data:
+					address += data_offset;
+					limit = symbols_offset;
+					break;
+				default:
+					break;
+			}
+			entries.emplace_back(address, limit, &name);
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const Entry &left, const Entry &right) {
+			if (left.address != right.address)
+				return left.address < right.address;
+			const bool left_internal = isInternalLabel(*left.name), right_internal = isInternalLabel(*right.name);
+			if (left_internal != right_internal)
+				return right_internal;
+			return *left.name < *right.name;
+		});
+
+		// Replace the section limits with the distance to the next address.
+		for (size_t i = 0, count = entries.size(); i < count;) {
+			size_t j = i + 1;
+			while (j < count && entries[j].address == entries[i].address)
+				++j;
+			const Word next = j < count? entries[j].address : -1;
+			for (; i < j; ++i) {
+				Entry &entry = entries[i];
+				const Word limit = entry.size;
+				Word end = next;
+				if (limit != -1 && entry.address < limit && (end == -1 || limit < end))
+					end = limit;
+				entry.size = end == -1? 8 : end - entry.address;
+			}
+		}
+	}
+
+	void SymbolIndex::clear() {
+		entries.clear();
+	}
+
+	const SymbolIndex::Entry * SymbolIndex::nearest(Word address) const {
+		auto iter = std::upper_bound(entries.begin(), entries.end(), address, [](Word address, const Entry &entry) {
+			return address < entry.address;
+		});
+
+		if (iter == entries.begin())
+			return nullptr;
+
+		// Step back to the first (preferred) entry of the group sharing this address.
+		const Word found = (--iter)->address;
+		while (iter != entries.begin() && std::prev(iter)->address == found)
+			--iter;
+		return &*iter;
+	}
+
+	const SymbolIndex::Entry * SymbolIndex::find(Word address) const {
+		const Entry *entry = nearest(address);
+		return entry && entry->contains(address)? entry : nullptr;
+	}
+
+	std::pair<SymbolIndex::const_iterator, SymbolIndex::const_iterator> SymbolIndex::at(Word address) const {
+		auto begin = std::lower_bound(entries.begin(), entries.end(), address, [](const Entry &entry, Word address) {
+			return entry.address < address;
+		});
+
+		auto end = begin;
+		while (end != entries.end() && end->address == address)
+			++end;
+		return {begin, end};
+	}
+
+	const std::string * SymbolIndex::nameAt(Word address) const {
+		const auto [begin, end] = at(address);
+		return begin == end? nullptr : begin->name;
+	}
+
+	bool SymbolIndex::isInternalLabel(const std::string &name) {
+		// Equivalent to matching ^__.+_label\d+$, without the cost of a regex.
+		if (name.size() < 9 || name[0] != '_' || name[1] != '_' || !std::isdigit(name.back()))
+			return false;
+		size_t i = name.size() - 1;
+		while (2 < i && std::isdigit(name[i]))
+			--i;
+		return 8 <= i && name.compare(i - 5, 6, "_label") == 0;
+	}
+}
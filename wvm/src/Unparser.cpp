@@ -173,6 +173,7 @@ namespace WVM::Unparser {
 			case OP_QUERY:
 				switch (funct) {
 					case FN_QM: return "? \e[36mmem\e[39m \e[2m->\e[22m " + color(rd);
+					case FN_QC: return "? \e[36mctr\e[39m " + color(rs) + " \e[2m->\e[22m " + color(rd);
 				}
 				break;
 			case OP_INTERRUPTS:
@@ -329,21 +330,7 @@ namespace WVM::Unparser {
 	}
 
 	std::string getSymbol(Word location, const VM &vm) {
-		for (const auto &[name, symbol]: vm.symbolTable) {
-			Word address = symbol.location;
-			switch (symbol.type) {
-				case SymbolEnum::Data:
-					address += vm.dataOffset;
-					break;
-				case SymbolEnum::Code:
-					address += vm.codeOffset;
-					break;
-				default:
-					break;
-			}
-			if (location == address)
-				return name;
-		}
-		return {};
+		const std::string *name = vm.symbolIndex.nameAt(location);
+		return name? *name : std::string();
 	}
 }
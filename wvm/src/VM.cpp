@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cerrno>
 #include <csignal>
 #include <cstring>
@@ -6,6 +7,7 @@
 #include <iomanip>
 #include <iostream>
 #include <regex>
+#include <sstream>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -28,12 +30,17 @@
 #define CATCH_TICK_IN_PLAY
 
 namespace WVM {
-	VM::VM(size_t memory_size, bool keep_initial): memorySize(memory_size), keepInitial(keep_initial) {}
+	VM::VM(size_t memory_size, bool keep_initial):
+		memorySize(memory_size), keepInitial(keep_initial),
+		pageEpochs((memory_size + EPOCH_PAGE_SIZE - 1) / EPOCH_PAGE_SIZE, memoryEpoch) {}
 
 	VM::~VM() {
-		for (const Drive &drive: drives)
-			if (::close(drive.fd) == -1)
-				std::cerr << "Couldn't close " << drive.name << " (" << drive.fd << "): " << strerror(errno) << "\n";
+		// The timer thread is detached, so it has to be told to stop before the VM goes away.
+		if (timerActive) {
+			timerActive = false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
 	}
 
 	bool VM::getZ() { return (st() & 0b0001) != 0; }
@@ -51,7 +58,7 @@ namespace WVM {
 	}
 
 	std::string VM::demangleLabel(const std::string &str) {
-		std::regex why_label_regex("^__(.+)_label\\d+$");
+		static const std::regex why_label_regex("^__(.+)_label\\d+$");
 		if (std::regex_match(str, why_label_regex))
 			return Haunted::Util::demangle(std::regex_replace(str, why_label_regex, "$1"));
 		return Haunted::Util::demangle(str);
@@ -65,6 +72,7 @@ namespace WVM {
 		}
 
 		lastVirtual = virtual_address;
+		++counters.translations;
 
 		if (!p0) {
 #ifdef DEBUG_VIRTMEM
@@ -144,6 +152,9 @@ namespace WVM {
 		}
 #endif
 
+		if (p5_entry.present)
+			++counters.successfulTranslations;
+
 		lastMeta = p5_entry;
 
 		if (meta_out)
@@ -171,6 +182,7 @@ namespace WVM {
 		else
 			for (char i = 0; i < 8; i++)
 				memory[address + 7 - i] = (value >> (8*i)) & 0xff;
+		markWritten(address, 8);
 		onUpdateMemory(programCounter, address - (address % 8), address, Size::Word);
 		if (address % 8 != 0)
 			onUpdateMemory(programCounter, address - (address % 8) + 8, address, Size::Word);
@@ -189,6 +201,7 @@ namespace WVM {
 				memory[address + 3 - i] = (value >> (8*i)) & 0xff;
 		}
 
+		markWritten(address, 4);
 		onUpdateMemory(programCounter, address - (address % 8), address, Size::HWord);
 		if (4 < address % 8)
 			onUpdateMemory(programCounter, address - (address % 8) + 8, address, Size::HWord);
@@ -207,6 +220,7 @@ namespace WVM {
 			memory[address + 1] = value & 0xff;
 		}
 
+		markWritten(address, 2);
 		onUpdateMemory(programCounter, address - (address % 8), address, Size::QWord);
 		if (6 < address % 8)
 			onUpdateMemory(programCounter, address - (address % 8) + 8, address, Size::QWord);
@@ -218,6 +232,7 @@ namespace WVM {
 				std::to_string(programCounter));
 
 		memory[address] = value;
+		markWritten(address, 1);
 		onUpdateMemory(programCounter, address - (address % 8), address, Size::Byte);
 	}
 
@@ -314,16 +329,19 @@ namespace WVM {
 	void VM::resize(size_t new_size) {
 		memory.resize(new_size);
 		memorySize = new_size;
+		dirtyWords.resize(new_size);
+		// Newly added pages count as changed.
+		pageEpochs.resize((new_size + EPOCH_PAGE_SIZE - 1) / EPOCH_PAGE_SIZE, memoryEpoch);
+		rebuildWatchedPages();
 	}
 
 	void VM::jump(Word address, bool should_link, bool from_rt) {
 		if (should_link) {
 			link(false);
 			if (logJumps) {
-				auto [begin, end] = symbolsByPosition.equal_range(address);
-				if (begin != end) {
-					std::cerr << "\e[32mJumping\e[39m to " << begin->second << '\n';
-					jumpStack.push_back(&begin->second);
+				if (const std::string *name = symbolIndex.nameAt(address)) {
+					std::cerr << "\e[32mJumping\e[39m to " << *name << '\n';
+					jumpStack.push_back(name);
 				}
 			}
 		}
@@ -360,8 +378,10 @@ namespace WVM {
 
 		bufferChange<RingChange>(old_ring, new_ring);
 		ring = new_ring;
-		if (old_ring != new_ring)
+		if (old_ring != new_ring) {
+			++counters.ringTransitions;
 			onRingChange(old_ring, new_ring);
+		}
 		return true;
 	}
 
@@ -401,6 +421,8 @@ namespace WVM {
 			// Disable hardware interrupts if jumping to one.
 			if (in_map.canDisable)
 				hardwareInterruptsEnabled = false;
+			if (size_t(type) < counters.interrupts.size())
+				++counters.interrupts[size_t(type)];
 			pagingStack.emplace_back(*this);
 			pagingOn = false;
 			// TODO: Add an instruction to set a "kernel P0" that's stored in a separate field in the VM and set p0 to
@@ -428,6 +450,7 @@ namespace WVM {
 
 	bool VM::intPfault() {
 		auto lock = lockVM();
+		++counters.pageFaults;
 		bufferChange<RegisterChange>(*this, Why::exceptionOffset + 2, lastVirtual);
 		registers[Why::exceptionOffset + 2] = lastVirtual;
 		onRegisterChange(Why::exceptionOffset + 2);
@@ -484,13 +507,14 @@ namespace WVM {
 			if (playing && active && !paused) {
 				const std::chrono::microseconds delay(microdelay);
 				onPlayStart();
-				playThreadAlive = true;
+				PerfCounters::Stopwatch running_watch(counters.hostRunning, counters.runningSince);
 				do {
 					if (resting.load()) {
-						std::unique_lock<std::mutex> lock(restMutex);
-						restCondition.wait(lock, [this] { return !resting.load(); });
-						restAcknowledged.store(true);
-						restAcknowledgeCondition.notify_all();
+						flushOutput();
+						PerfCounters::Stopwatch idle_watch(counters.hostIdle, counters.idleSince);
+						while (!awaitWake(std::chrono::milliseconds(100)) && playing);
+						if (!playing)
+							break;
 					}
 #ifdef CATCH_TICK_IN_PLAY
 					try {
@@ -515,7 +539,7 @@ namespace WVM {
 					if (microdelay)
 						std::this_thread::sleep_for(delay);
 				} while (playing && active && !paused);
-				playThreadAlive = false;
+				flushOutput();
 				onPlayEnd();
 			}
 			playing = false;
@@ -524,6 +548,31 @@ namespace WVM {
 		return true;
 	}
 
+	void VM::print(std::string_view text) {
+		const auto now = std::chrono::steady_clock::now();
+		const bool newline = text.find('\n') != std::string_view::npos;
+		if (outputBuffer.empty())
+			outputStart = now;
+		while (!text.empty()) {
+			const size_t count = std::min(text.size(), OUTPUT_CHUNK_SIZE - outputBuffer.size());
+			outputBuffer.append(text.substr(0, count));
+			text.remove_prefix(count);
+			if (outputBuffer.size() == OUTPUT_CHUNK_SIZE)
+				flushOutput();
+		}
+
+		if (!outputBuffer.empty() && (newline || OUTPUT_FLUSH_INTERVAL <= now - outputStart))
+			flushOutput();
+	}
+
+	void VM::flushOutput() {
+		auto lock = lockVM();
+		if (outputBuffer.empty())
+			return;
+		onPrint(outputBuffer);
+		outputBuffer.clear();
+	}
+
 	bool VM::pause() {
 		return playing.exchange(false);
 	}
@@ -533,12 +582,15 @@ namespace WVM {
 			return;
 
 		restAcknowledged = false;
+		bool waiting;
 		{
 			std::unique_lock<std::mutex> lock(restMutex);
 			resting = false;
+			waiting = restWaiting;
 			restCondition.notify_all();
 		}
-		if (playThreadAlive.load()) {
+		onWake();
+		if (waiting) {
 			std::unique_lock<std::mutex> lock(restAcknowledgeMutex);
 			restAcknowledgeCondition.wait(lock, [this] { return restAcknowledged.load(); });
 		}
@@ -549,6 +601,18 @@ namespace WVM {
 		resting = true;
 	}
 
+	bool VM::awaitWake(std::chrono::microseconds timeout) {
+		std::unique_lock<std::mutex> lock(restMutex);
+		restWaiting = true;
+		const bool awake = restCondition.wait_for(lock, timeout, [this] { return !resting.load(); });
+		restWaiting = false;
+		if (awake) {
+			restAcknowledged.store(true);
+			restAcknowledgeCondition.notify_all();
+		}
+		return awake;
+	}
+
 	bool VM::undo() {
 		if (undoPointer == 0)
 			return false;
@@ -570,6 +634,13 @@ namespace WVM {
 		return true;
 	}
 
+	void VM::clearHistory() {
+		auto lock = lockVM();
+		undoStack.clear();
+		changeBuffer.clear();
+		undoPointer = 0;
+	}
+
 	bool VM::tick() {
 		auto lock = lockVM();
 		bool success = false;
@@ -583,6 +654,8 @@ namespace WVM {
 		}
 
 		UWord instruction = getWord(translated, Endianness::Big);
+		if (profiler.isRunning())
+			profiler.record(programCounter);
 #ifdef CATCH_TICK
 		try {
 #endif
@@ -596,8 +669,20 @@ namespace WVM {
 #endif
 
 		++cycles;
+		counters.retire((Util::swapEndian(instruction) >> 52) & 0xfff);
+
+		if (sampler.isRunning())
+			sampler.tick();
 
-		if (hasBreakpoint(programCounter)) {
+		if (watchTriggered) {
+			watchTriggered = false;
+			clearTemporaryBreakpoints();
+			paused = true;
+			onWatchpoint(watchpoints.at(watchHit), watchHitAddress, watchHitPC, watchHitWrite);
+			return false;
+		}
+
+		if (breakpointFilter[breakpointBucket(programCounter)] && checkBreakpoint()) {
 			paused = true;
 			return false;
 		}
@@ -635,13 +720,53 @@ namespace WVM {
 		}
 	}
 
+	void VM::rebuildBreakpointFilter() {
+		breakpointFilter.reset();
+		for (const Word breakpoint: breakpoints)
+			breakpointFilter.set(breakpointBucket(breakpoint));
+		for (const Word breakpoint: temporaryBreakpoints)
+			breakpointFilter.set(breakpointBucket(breakpoint));
+	}
+
+	bool VM::checkBreakpoint() {
+		if (temporaryBreakpoints.count(programCounter) == 0) {
+			if (!hasBreakpoint(programCounter))
+				return false;
+			auto iter = breakpointRules.find(programCounter);
+			if (iter != breakpointRules.end() && !iter->second.hit(*this))
+				return false;
+		}
+		clearTemporaryBreakpoints();
+		return true;
+	}
+
 	void VM::addBreakpoint(Word breakpoint) {
-		breakpoints.insert(breakpoint);
+		{
+			auto lock = lockVM();
+			breakpoints.insert(breakpoint);
+			breakpointRules.erase(breakpoint);
+			breakpointFilter.set(breakpointBucket(breakpoint));
+		}
+		onAddBreakpoint(breakpoint);
+	}
+
+	void VM::addBreakpoint(Word breakpoint, BreakpointRule &&rule) {
+		{
+			auto lock = lockVM();
+			breakpoints.insert(breakpoint);
+			breakpointRules.insert_or_assign(breakpoint, std::move(rule));
+			breakpointFilter.set(breakpointBucket(breakpoint));
+		}
 		onAddBreakpoint(breakpoint);
 	}
 
 	void VM::removeBreakpoint(Word breakpoint) {
-		breakpoints.erase(breakpoint);
+		{
+			auto lock = lockVM();
+			breakpoints.erase(breakpoint);
+			breakpointRules.erase(breakpoint);
+			rebuildBreakpointFilter();
+		}
 		onRemoveBreakpoint(breakpoint);
 	}
 
@@ -653,6 +778,82 @@ namespace WVM {
 		return 0 < breakpoints.count(breakpoint);
 	}
 
+	const BreakpointRule * VM::getBreakpointRule(Word breakpoint) const {
+		auto iter = breakpointRules.find(breakpoint);
+		return iter == breakpointRules.end()? nullptr : &iter->second;
+	}
+
+	void VM::addTemporaryBreakpoint(Word breakpoint) {
+		auto lock = lockVM();
+		temporaryBreakpoints.insert(breakpoint);
+		breakpointFilter.set(breakpointBucket(breakpoint));
+	}
+
+	void VM::clearTemporaryBreakpoints() {
+		auto lock = lockVM();
+		if (!temporaryBreakpoints.empty()) {
+			temporaryBreakpoints.clear();
+			rebuildBreakpointFilter();
+		}
+	}
+
+	void VM::rebuildWatchedPages() {
+		watchedPages.clear();
+		if (watchpoints.empty())
+			return;
+		watchedPages.resize(memorySize / PAGE_SIZE + 1, 0);
+		for (const Watchpoint &watchpoint: watchpoints) {
+			const size_t first = std::min<UWord>(watchpoint.address / PAGE_SIZE, watchedPages.size() - 1);
+			const size_t last = std::min<UWord>((watchpoint.address + watchpoint.length - 1) / PAGE_SIZE,
+				watchedPages.size() - 1);
+			for (size_t page = first; page <= last; ++page)
+				watchedPages[page] |= watchpoint.access;
+		}
+	}
+
+	void VM::checkWatchpoints(Word address, Word length, Watchpoint::Access access) {
+		if (watchTriggered || address < 0)
+			return;
+		const UWord first = UWord(address) / PAGE_SIZE;
+		const UWord last = std::min<UWord>(UWord(address + length - 1) / PAGE_SIZE, watchedPages.size() - 1);
+		bool watched = false;
+		for (UWord page = first; page <= last && !watched; ++page)
+			watched = (watchedPages[page] & access) != 0;
+		if (watched) {
+			for (size_t i = 0; i < watchpoints.size(); ++i) {
+				const Watchpoint &watchpoint = watchpoints[i];
+				if ((watchpoint.access & access) && address < watchpoint.address + watchpoint.length &&
+				    watchpoint.address < address + length) {
+					watchTriggered = true;
+					watchHit = i;
+					watchHitAddress = std::max(address, watchpoint.address);
+					watchHitPC = programCounter;
+					watchHitWrite = access == Watchpoint::Write;
+					return;
+				}
+			}
+		}
+	}
+
+	void VM::addWatchpoint(Word address, Word length, Watchpoint::Access access) {
+		if (address < 0 || length <= 0)
+			throw std::invalid_argument("Invalid watchpoint range");
+		auto lock = lockVM();
+		watchpoints.emplace_back(address, length, access);
+		rebuildWatchedPages();
+	}
+
+	bool VM::removeWatchpoint(Word address) {
+		auto lock = lockVM();
+		const size_t old_size = watchpoints.size();
+		watchpoints.erase(std::remove_if(watchpoints.begin(), watchpoints.end(), [address](const Watchpoint &watchpoint) {
+			return watchpoint.address == address;
+		}), watchpoints.end());
+		watchTriggered = false;
+		rebuildWatchedPages();
+		return watchpoints.size() != old_size;
+	}
+
 	void VM::load(const std::string &path, const std::vector<std::string> &disks) {
 		load(std::filesystem::path(path), disks);
 	}
@@ -687,8 +888,8 @@ namespace WVM {
 
 		std::string line;
 		int lineno = 0;
-		memory.clear();
 		memory.resize(memorySize);
+		memory.zero();
 		while (std::getline(stream, line)) {
 			++lineno;
 			char *endptr;
@@ -701,6 +902,11 @@ namespace WVM {
 		if (keepInitial)
 			initial = memory;
 
+		// Everything changed, and the writes made from now on are distinguishable from the image.
+		loadEpoch = ++memoryEpoch;
+		pageEpochs.fill(loadEpoch);
+		++memoryEpoch;
+
 		init();
 	}
 
@@ -717,32 +923,160 @@ namespace WVM {
 			relocationOffset = getWord(32, Endianness::Little);
 		if (endOffset == -1)
 			endOffset = getWord(40, Endianness::Little);
+		initRegisters();
+		loadSymbols();
+		loadDebugData();
+	}
+
+	void VM::initRegisters() {
 		registers[Why::globalAreaPointerOffset] = endOffset;
 		sp() = memorySize;
 		onRegisterChange(Why::globalAreaPointerOffset);
 		onRegisterChange(Why::stackPointerOffset);
-		loadSymbols();
-		loadDebugData();
 	}
 
 	void VM::reset(bool reload) {
-		if (reload) {
-			if (!loadedFrom.empty())
-				load(loadedFrom);
-			else
-				throw std::runtime_error("Unable to reset VM: path was stored");
+		const bool restore = !reload && keepInitial;
+		if (!restore && loadedFrom.empty())
+			throw std::runtime_error(reload? "Unable to reset VM: path was stored" :
+				"Unable to reset VM: no initial memory or path was stored");
+
+		flushOutput();
+
+		for (unsigned char id = 0; id < Why::totalRegisters; ++id)
+			if (registers[id] != 0) {
+				registers[id] = 0;
+				onRegisterChange(id);
+			}
+
+		if (ring != Ring::Zero) {
+			const Ring old_ring = ring;
+			ring = Ring::Zero;
+			onRingChange(old_ring, ring);
+		}
+
+		if (pagingOn) {
+			pagingOn = false;
+			onPagingChange(false);
+		}
+
+		if (p0 != 0) {
+			p0 = 0;
+			onP0Change(0);
+		}
+
+		if (interruptTableAddress != 0) {
+			interruptTableAddress = 0;
+			onInterruptTableChange();
+		}
+
+		hardwareInterruptsEnabled = true;
+		pagingStack.clear();
+
+		if (restore) {
+			restoreInitial();
+			// The symbols and debug data are in the restored image, so they don't need to be parsed again.
+			initRegisters();
 		} else {
-			if (keepInitial)
-				memory = initial;
-			else if (!loadedFrom.empty())
-				load(loadedFrom);
-			else
-				throw std::runtime_error("Unable to reset VM: no initial memory or path was stored");
+			load(loadedFrom);
 		}
-		init();
+
+		programCounter = codeOffset;
+	}
+
+	void VM::restoreInitial() {
+		// Only the pages written since the program was loaded (or last reset) can differ from the initial image.
+		changedSince(loadEpoch + 1, [&](Word address, size_t length) {
+			const size_t from_initial = address < Word(initial.size())? std::min(length, initial.size() - address) : 0;
+			std::memcpy(memory.data() + address, initial.data() + address, from_initial);
+			std::memset(memory.data() + address + from_initial, 0, length - from_initial);
+			dirtyWords.mark(address, length);
+		});
+		// Clients may have seen the restored pages change, so they count as changed now. Once this epoch ends, they're
+		// part of the image again.
+		pageEpochs.replace(loadEpoch, memoryEpoch);
+		loadEpoch = memoryEpoch++;
+	}
+
+	VM::Snapshot VM::snapshot() {
+		auto lock = lockVM();
+		Snapshot out;
+		out.memory = memory;
+		// Copying forked memory only copies what it still shares with its own snapshot.
+		if (memory.isForked())
+			changedSince(forkEpoch, [&](Word address, size_t length) {
+				std::memcpy(out.memory.data() + address, memory.data() + address, length);
+			});
+		out.initial = initial;
+		for (const Drive &drive: drives)
+			out.drives.push_back(drive.snapshot());
+		return out;
+	}
+
+	void VM::forkFrom(VM &parent, const Snapshot &snapshot) {
+		auto lock = lockVM();
+		auto parent_lock = parent.lockVM();
+		memory = snapshot.memory.fork();
+		initial = snapshot.initial.fork();
+		loadedFrom = parent.loadedFrom;
+		memorySize = parent.memorySize;
+		keepInitial = parent.keepInitial;
+		active = parent.active.load();
+		memoryEpoch = parent.memoryEpoch;
+		loadEpoch = parent.loadEpoch;
+		pageEpochs = parent.pageEpochs;
+		forkEpoch = ++memoryEpoch;
+		cycles = parent.cycles;
+		breakpoints = parent.breakpoints;
+		breakpointRules = parent.breakpointRules;
+		rebuildBreakpointFilter();
+		watchpoints = parent.watchpoints;
+		rebuildWatchedPages();
+		lastMeta = parent.lastMeta;
+		lastVirtual = parent.lastVirtual;
+
+		ring = parent.ring;
+		programCounter = parent.programCounter;
+		interruptTableAddress = parent.interruptTableAddress;
+		std::copy(std::begin(parent.registers), std::end(parent.registers), registers);
+		symbolTable = parent.symbolTable;
+		debugMap = parent.debugMap;
+		debugFiles = parent.debugFiles;
+		debugFunctions = parent.debugFunctions;
+		drives.clear();
+		for (const Drive &drive: snapshot.drives)
+			drives.push_back(drive.overlay());
+		codeOffset = parent.codeOffset;
+		dataOffset = parent.dataOffset;
+		symbolsOffset = parent.symbolsOffset;
+		debugOffset = parent.debugOffset;
+		relocationOffset = parent.relocationOffset;
+		endOffset = parent.endOffset;
+		// The index points into the symbol table, so it can't be copied.
+		symbolIndex.build(symbolTable, codeOffset, dataOffset, symbolsOffset);
+		jumpStack.clear();
+		p0 = parent.p0;
+		paused = parent.paused.load();
+		strict = parent.strict;
+		pagingOn = parent.pagingOn;
+		enableHistory = parent.enableHistory;
+		resting = parent.resting.load();
+		hardwareInterruptsEnabled = parent.hardwareInterruptsEnabled;
+		logJumps = parent.logJumps;
+		pagingStack = parent.pagingStack;
+		if (parent.timerActive)
+			setTimer(parent.timerTicks);
+	}
+
+	void VM::changedSince(UWord epoch, const std::function<void(Word, size_t)> &fn) const {
+		pageEpochs.forEachRun(epoch, [&](size_t first, size_t count) {
+			const size_t start = first * EPOCH_PAGE_SIZE;
+			fn(start, std::min((first + count) * EPOCH_PAGE_SIZE, memorySize) - start);
+		});
 	}
 
 	void VM::loadSymbols() {
+		jumpStack.clear();
 		symbolTable.clear();
 		for (Word i = symbolsOffset; i < debugOffset && size_t(i + 16) < memorySize;) {
 			const QWord length = getQuarterword(i, Endianness::Little);
@@ -753,9 +1087,36 @@ namespace WVM {
 				break;
 			const std::string name = getString(i + 16, length * 8);
 			symbolTable.emplace(name, Symbol(hash, location, SymbolEnum(type)));
-			symbolsByPosition.emplace(location, name);
 			i += 16 + length * 8;
 		}
+
+		symbolIndex.build(symbolTable, codeOffset, dataOffset, symbolsOffset);
+	}
+
+	std::string VM::symbolize(Word address) const {
+		std::stringstream ss;
+		ss << address;
+		if (const SymbolIndex::Entry *entry = symbolIndex.find(address)) {
+			ss << " <" << demangleLabel(*entry->name);
+			if (address != entry->address)
+				ss << "+" << (address - entry->address);
+			ss << ">";
+		}
+		return ss.str();
+	}
+
+	Word VM::symbolAddress(const std::string &name) const {
+		auto iter = symbolTable.find(name);
+		if (iter == symbolTable.end())
+			return -1;
+
+		// Code and data symbols are stored relative to the start of their sections (see SymbolIndex::build).
+		const Symbol &symbol = iter->second;
+		switch (symbol.type) {
+			case SymbolEnum::Code: return symbol.location + codeOffset;
+			case SymbolEnum::Data: return symbol.location + dataOffset;
+			default: return symbol.location;
+		}
 	}
 
 	void VM::loadDebugData() {
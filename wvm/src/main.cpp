@@ -7,6 +7,7 @@
 #include "mode/MemoryMode.h"
 #include "mode/OutputMode.h"
 #include "mode/RegistersMode.h"
+#include "mode/RunMode.h"
 #include "mode/ServerMode.h"
 #include "net/NetError.h"
 #include "net/Server.h"
@@ -17,6 +18,7 @@ std::optional<WVM::Mode::ServerMode> server;
 void usage() {
 	std::cerr << "Usage:\n"
 	          << "- wvm server <executable> [files]...\n"
+	          << "- wvm run [--profile] [--folded <path> [--sample-every <instructions>]] <executable> [files]...\n"
 	          << "- wvm registers <hostname> <port>\n"
 	          << "- wvm memory <hostname> <port>\n"
 	          << "- wvm console <hostname> <port>\n";
@@ -51,6 +53,35 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
+	if (arg == "run") {
+		WVM::Mode::RunMode run;
+		int first = 2;
+		for (; first < argc && std::string(argv[first]).substr(0, 2) == "--"; ++first) {
+			const std::string option = argv[first];
+			if (option == "--profile") {
+				run.profile = true;
+			} else if (option == "--folded" && first + 1 < argc) {
+				run.foldedPath = argv[++first];
+			} else if (option == "--sample-every" && first + 1 < argc) {
+				if (!WVM::Util::parseUL(argv[++first], run.sampleInterval) || run.sampleInterval == 0) {
+					std::cerr << "Invalid sample interval: " << argv[first] << "\n";
+					return 1;
+				}
+			} else {
+				usage();
+				return 1;
+			}
+		}
+
+		if (argc <= first) {
+			usage();
+			return 1;
+		}
+
+		const std::vector<std::string> files(argv + first + 1, argv + argc);
+		return run.run(argv[first], files);
+	}
+
 	std::string hostname;
 	WVM::UWord port;
 
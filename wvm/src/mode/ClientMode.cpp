@@ -1,4 +1,9 @@
+#include <iomanip>
+#include <sstream>
+
+#include "lib/ansi.h"
 #include "mode/ClientMode.h"
+#include "net/Binary.h"
 
 namespace WVM::Mode {
 	void ClientMode::run(const std::string &hostname, int port) {
@@ -10,11 +15,26 @@ namespace WVM::Mode {
 	void ClientMode::loop() {
 		std::iostream stream(&*buffer);
 		std::string line;
-		while (std::getline(stream, line)) {
+		while (!binary && std::getline(stream, line)) {
 			if (line.back() == '\n')
 				line.pop_back();
+			// The acknowledgement is the last message the server sends as a line.
+			if (line == ":Binary on")
+				binary = true;
 			handleMessage(line);
 		}
+
+		if (!binary)
+			return;
+
+		char header[Net::Binary::LENGTH_SIZE];
+		std::string body;
+		while (stream.read(header, sizeof(header))) {
+			body.resize(Net::Binary::readU32(std::string_view(header, sizeof(header)), 0));
+			if (body.empty() || !stream.read(body.data(), body.size()))
+				break;
+			handleFrame(body);
+		}
 	}
 
 	void ClientMode::stop() {
@@ -25,4 +45,76 @@ namespace WVM::Mode {
 		if (socket)
 			socket->close();
 	}
-}
\ No newline at end of file
+
+	void ClientMode::handleFrame(std::string_view body) {
+		using Net::Binary::Opcode, Net::Binary::readU64, Net::Binary::readU8;
+		try {
+			switch (static_cast<Opcode>(body.at(0))) {
+				case Opcode::Text:
+					handleMessage(std::string(body.substr(1)));
+					break;
+				case Opcode::MemoryWord:
+					handleMemoryWord(readU64(body, 1), readU64(body, 9), readU64(body, 17), readU8(body, 25));
+					break;
+				case Opcode::Register:
+					handleRegister(readU8(body, 1), readU64(body, 2));
+					break;
+				case Opcode::PC:
+					handlePC(readU64(body, 1));
+					break;
+				case Opcode::Output:
+					handleOutput(body.substr(1));
+					break;
+				case Opcode::MemoryRun:
+					handleMemoryRun(readU64(body, 1), body.substr(9));
+					break;
+				case Opcode::RegisterSnapshot: {
+					std::vector<std::pair<UByte, Word>> snapshot;
+					const size_t count = readU8(body, 1);
+					for (size_t i = 0; i < count; ++i)
+						snapshot.emplace_back(readU8(body, 2 + 9 * i), readU64(body, 3 + 9 * i));
+					handleRegisterSnapshot(snapshot);
+					break;
+				}
+				default:
+					DBG("Unknown frame opcode: " << int(UByte(body[0])));
+			}
+		} catch (const std::out_of_range &) {
+			DBG("Truncated frame with opcode " << int(UByte(body[0])));
+		}
+	}
+
+	void ClientMode::handleMemoryWord(Word address, Word value, Word pc, UByte size) {
+		handleMessage(":MemoryWord " + std::to_string(address) + " " + std::to_string(value) + " " + std::to_string(pc) +
+			" " + (size == 0? "?" : std::to_string(size) + "B"));
+	}
+
+	void ClientMode::handleMemoryRun(Word address, std::string_view bytes) {
+		std::stringstream ss;
+		ss << ":MemoryRun " << address << " " << bytes.size() / 8 << std::hex;
+		for (size_t i = 0; i + 8 <= bytes.size(); i += 8)
+			ss << " " << Net::Binary::readU64(bytes, i);
+		handleMessage(ss.str());
+	}
+
+	void ClientMode::handleRegister(UByte id, Word value) {
+		handleMessage(":Register " + std::to_string(id) + " " + std::to_string(value));
+	}
+
+	void ClientMode::handleRegisterSnapshot(const std::vector<std::pair<UByte, Word>> &snapshot) {
+		for (const auto &[id, value]: snapshot)
+			handleRegister(id, value);
+	}
+
+	void ClientMode::handlePC(Word pc) {
+		handleMessage(":PC " + std::to_string(pc));
+	}
+
+	void ClientMode::handleOutput(std::string_view bytes) {
+		std::stringstream ss;
+		ss << ":Output " << std::hex << std::setfill('0');
+		for (const char ch: bytes)
+			ss << std::setw(2) << static_cast<int>(UByte(ch));
+		handleMessage(ss.str());
+	}
+}
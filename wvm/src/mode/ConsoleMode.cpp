@@ -103,8 +103,12 @@ namespace WVM::Mode {
 				*textbox += std::string(infoPrefix) + "Register " + Why::coloredRegister(reg) + " set to \e[1m"
 					+ split[1] + "\e[22m.";
 		} else if (verb == "AddedBP") {
+			// Conditional breakpoints and ones with hit counts come with a description, such as "if $r0 == 5".
 			if (split.size() == 1)
 				*textbox += std::string(infoPrefix) + "Added breakpoint at " + split[0] + ".";
+			else if (1 < split.size())
+				*textbox += std::string(infoPrefix) + "Added breakpoint at " + split[0] + " \e[1m"
+					+ Util::join(split.begin() + 1, split.end()) + "\e[22m.";
 		} else if (verb == "LogMemoryWrites") {
 			if (split.size() == 1)
 				*textbox += std::string(infoPrefix) + "Memory write logging turned " + split[0] + ".";
@@ -272,6 +276,11 @@ namespace WVM::Mode {
 				*socket << ":PrintOps " << count << "\n";
 		} else if (first == "stack" || first == "stacktrace" || first == "trace") {
 			*socket << ":Stacktrace\n";
+		} else if (first == "prof" || first == "profile") {
+			if (size == 1 || (size == 2 && split[0] == "report"))
+				*socket << ":Profile " << rest << "\n";
+			else
+				badInput();
 		} else if (first == "lmw") {
 			*socket << ":LogMemoryWrites\n";
 		} else if (text.front() == ':') {
@@ -4,8 +4,10 @@
 #include "Util.h"
 
 #include <algorithm>
+#include <cstring>
 #include <format>
 #include <sstream>
+#include <fcntl.h>
 #include <unistd.h>
 
 namespace WVM::Mode {
@@ -117,17 +119,109 @@ namespace WVM::Mode {
 		textbox->focus();
 		expando->draw();
 		terminal.watchSize();
-		send(":Subscribe memory\n" ":GetMain\n" ":Subscribe pc\n" ":Subscribe breakpoints\n" ":Subscribe registers");
+		// A server on the same host can share its memory instead of sending it. If it can't, the reply to :Shared falls
+		// back to subscribing.
+		if (hostname == "localhost" || hostname == "127.0.0.1" || hostname == "::1")
+			send(":Binary on\n" ":Shared\n" ":Subscribe breakpoints");
+		else
+			subscribe();
 		send(":Reg " + std::to_string(Why::stackPointerOffset));
 		autotickReady = true;
 		autotickMutex.unlock();
 		autotickVariable.notify_all();
 		terminal.join();
 		networkThread.join();
+		alive = false;
+		if (sharedThread.joinable())
+			sharedThread.join();
 		autotickMutex.lock();
 		autotickThread.join();
 	}
 
+	void MemoryMode::subscribe() {
+		// Memory, register and PC updates are by far the most common messages, so they're received as binary frames.
+		send(":Binary on\n" ":Subscribe memory\n" ":GetMain\n" ":Subscribe pc\n" ":Subscribe breakpoints\n" ":Subscribe registers");
+	}
+
+	void MemoryMode::mapShared(const std::vector<std::string> &split) {
+		Word pid, memory_descriptor, state_descriptor;
+		if (split.size() != 3 || !Util::parseLong(split[0], pid) || !Util::parseLong(split[1], memory_descriptor)
+		    || !Util::parseLong(split[2], state_descriptor))
+			throw std::runtime_error("Invalid :Shared reply");
+
+		auto open = [pid](Word descriptor) {
+			const std::string path = "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(descriptor);
+			const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd == -1)
+				throw std::runtime_error("Couldn't open " + path + ": " + strerror(errno));
+			return fd;
+		};
+
+		const int state_fd = open(state_descriptor);
+		try {
+			sharedState = Net::SharedState::view(state_fd);
+		} catch (...) {
+			::close(state_fd);
+			throw;
+		}
+		::close(state_fd);
+
+		const int memory_fd = open(memory_descriptor);
+		try {
+			vm.memory = Memory::view(memory_fd, sharedState->getMemorySize());
+		} catch (...) {
+			::close(memory_fd);
+			sharedState.reset();
+			throw;
+		}
+		::close(memory_fd);
+
+		// The offsets and symbols are read straight from the mapped image, and events from now on bring the
+		// snapshot up to date.
+		vm.resize(sharedState->getMemorySize());
+		vm.init();
+		sharedCursor = sharedState->getCursor();
+		sharedState->readSnapshot(vm.registers, vm.programCounter);
+		min = 0;
+		max = vm.endOffset + 128 * 8;
+		padding = std::to_string(max).size();
+		makeSymbolTableEdges();
+		remakeList([this] { jumpToPC(); });
+		sharedThread = std::thread([this] { pollShared(); });
+	}
+
+	void MemoryMode::pollShared() {
+		using Status = Net::SharedState::Status;
+		using EventType = Net::SharedState::EventType;
+		while (alive) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(33));
+			Net::SharedState::Event event;
+			std::optional<Word> pc;
+			Status status;
+			while ((status = sharedState->next(sharedCursor, event)) == Status::Event) {
+				if (event.type == EventType::Register) {
+					handleRegister(event.argument, event.value);
+				} else if (event.type == EventType::PC) {
+					pc = event.value;
+				} else {
+					for (UWord i = 0; i < event.argument; ++i)
+						updateLine(event.value + 8 * i);
+				}
+			}
+
+			if (status == Status::Lost) {
+				// Too much happened since the last poll to replay, so everything is redrawn from the current state.
+				Word new_pc;
+				sharedState->readSnapshot(vm.registers, new_pc);
+				pc = new_pc;
+				remakeList();
+			}
+
+			if (pc)
+				handlePC(*pc);
+		}
+	}
+
 	void MemoryMode::toggleSearchbox() {
 		if (searching) {
 			expando->removeChild(textinput);
@@ -158,23 +252,17 @@ namespace WVM::Mode {
 			const std::string hyphens(42 + padding, '-');
 			const std::string spaces(24 + padding, ' ');
 
-			// First, make a set of all addresses that have one or more labels associated with them. This is faster than
-			// checking each symbol for each address every time.
-			std::unordered_set<Word> labeled;
-			if (showSymbols)
-				for (const std::pair<const std::string, Symbol> &pair: vm.symbolTable)
-					labeled.insert(pair.second.location);
-
 			for (Word address = min, i = 0; address < max + 128 * 8; address += 8, ++i) {
 				if (address == vm.symbolsOffset || address == vm.codeOffset || address == vm.dataOffset
 				    || address == vm.debugOffset || address == vm.relocationOffset || address == vm.endOffset) {
 					*textbox += "\e[2m" + hyphens + "\e[22m";
 				}
 
-				if (showSymbols && 0 < labeled.count(address))
-					for (const std::pair<const std::string, Symbol> &pair: vm.symbolTable)
-						if (pair.second.location == address)
-							*textbox += spaces + "\e[36m@\e[39;1;4m" + pair.first + "\e[22;24m";
+				if (showSymbols) {
+					const auto [begin, end] = vm.symbolIndex.at(address);
+					for (auto iter = begin; iter != end; ++iter)
+						*textbox += spaces + "\e[36m@\e[39;1;4m" + *iter->name + "\e[22;24m";
+				}
 
 				addLine(address);
 			}
@@ -292,6 +380,10 @@ namespace WVM::Mode {
 		const size_t size = split.size();
 
 		if (verb == "MemoryWords") {
+			// Mapped memory is always current and can't be written to.
+			if (sharedState)
+				return;
+
 			Word start, count;
 			UWord uword;
 			if (size < 2 || !Util::parseLong(split[0], start) || !Util::parseLong(split[1], count)
@@ -329,10 +421,27 @@ namespace WVM::Mode {
 				return;
 			}
 
-			vm.setWord(address, value);
-			try {
-				updateLine(address);
-			} catch (const std::out_of_range &) {}
+			handleMemoryWord(address, value, 0, 8);
+		} else if (verb == "MemoryRun") {
+			Word start, count;
+			UWord uword;
+			if (size < 2 || !Util::parseLong(split[0], start) || !Util::parseLong(split[1], count)
+			    || static_cast<Word>(size) != 2 + count) {
+				DBG("Invalid MemoryRun content: [" << rest << "]");
+				return;
+			}
+
+			std::string bytes(count * 8, '\0');
+			for (Word i = 0; i < count; ++i) {
+				if (!Util::parseUL(split[i + 2], uword, 16)) {
+					DBG("Invalid word at index " << i << ": " << split[i + 2]);
+					return;
+				}
+				for (int j = 0; j < 8; ++j)
+					bytes[i * 8 + j] = char(uword >> (8 * j));
+			}
+
+			handleMemoryRun(start, bytes);
 		} else if (verb == "MemorySize") {
 			Word resize_amount;
 			if (size != 1 || !Util::parseLong(split[0], resize_amount)) {
@@ -340,7 +449,8 @@ namespace WVM::Mode {
 				return;
 			}
 
-			vm.resize(resize_amount);
+			if (!sharedState)
+				vm.resize(resize_amount);
 		} else if (verb == "PC") {
 			Word to;
 			if (size != 1 || !Util::parseLong(split[0], to)) {
@@ -348,17 +458,7 @@ namespace WVM::Mode {
 				return;
 			}
 
-			auto lock = vm.lockVM();
-			const Word old_pc = vm.programCounter;
-			vm.programCounter = to;
-			if (!fastForward) {
-				if (lines.count(old_pc) == 1)
-					updateLine(old_pc);
-				if (lines.count(to) == 1)
-					updateLine(to);
-				if (follow)
-					jumpToPC();
-			}
+			handlePC(to);
 		} else if (verb == "FastForward") {
 			if (size != 1) {
 				DBG("Invalid: FastForward[" << rest << "]");
@@ -399,14 +499,7 @@ namespace WVM::Mode {
 				return;
 			}
 
-			if (reg == Why::stackPointerOffset) {
-				Word old_sp = vm.sp() - (vm.sp() % 8);
-				vm.registers[reg] = value;
-				updateLine(old_sp);
-				updateLine(vm.sp() - (vm.sp() % 8));
-			} else {
-				vm.registers[reg] = value;
-			}
+			handleRegister(reg, value);
 		} else if (verb == "Unpaused") {
 			vm.paused = false;
 		} else if (verb == "Paused") {
@@ -424,12 +517,68 @@ namespace WVM::Mode {
 			vm.codeOffset = code;
 			vm.dataOffset = data;
 			vm.endOffset = end;
+		} else if (verb == "Shared") {
+			try {
+				mapShared(split);
+			} catch (const std::exception &err) {
+				DBG("Couldn't map the server's memory: " << err.what());
+				subscribe();
+			}
+		} else if (verb == "UnknownVerb" && rest == "Shared") {
+			subscribe();
 		} else if (verb == "Quit") {
 			stop();
 			std::exit(0);
 		}
 	}
 
+	void MemoryMode::handleMemoryWord(Word address, Word value, Word, UByte) {
+		if (!sharedState)
+			vm.setWord(address, value);
+		try {
+			updateLine(address);
+		} catch (const std::out_of_range &) {}
+	}
+
+	void MemoryMode::handleMemoryRun(Word address, std::string_view bytes) {
+		if (vm.getMemorySize() < address + bytes.size())
+			return;
+		if (!sharedState)
+			std::copy(bytes.begin(), bytes.end(), vm.memory.begin() + address);
+		for (size_t offset = 0; offset < bytes.size(); offset += 8)
+			updateLine(address + offset);
+	}
+
+	void MemoryMode::handleRegister(UByte id, Word value) {
+		if (Why::totalRegisters <= id) {
+			DBG("Invalid register: " << int(id));
+			return;
+		}
+
+		if (id == Why::stackPointerOffset) {
+			Word old_sp = vm.sp() - (vm.sp() % 8);
+			vm.registers[id] = value;
+			updateLine(old_sp);
+			updateLine(vm.sp() - (vm.sp() % 8));
+		} else {
+			vm.registers[id] = value;
+		}
+	}
+
+	void MemoryMode::handlePC(Word to) {
+		auto lock = vm.lockVM();
+		const Word old_pc = vm.programCounter;
+		vm.programCounter = to;
+		if (!fastForward) {
+			if (lines.count(old_pc) == 1)
+				updateLine(old_pc);
+			if (lines.count(to) == 1)
+				updateLine(to);
+			if (follow)
+				jumpToPC();
+		}
+	}
+
 	void MemoryMode::startAutotick() {
 		send(":Unpause");
 		autotick = autotick < 0? -autotick : autotick;
@@ -40,28 +40,41 @@ namespace WVM::Mode {
 
 	void OutputMode::handleMessage(const std::string &message) {
 		if (message.front() != ':') {
-			if (message.size() != 2) {
-				DBG("Not sure how to handle [" << message << "]");
-				return;
-			}
-
-			Word to_print;
-			if (!Util::parseLong(message, to_print, 16)) {
-				DBG("Invalid raw message [" << message << "]");
-				return;
-			}
-
-			std::cout << static_cast<char>(to_print);
-			std::cout.flush();
+			DBG("Not sure how to handle [" << message << "]");
 			return;
 		}
 
 		const size_t space = message.find(' ');
 		const std::string verb = message.substr(1, space - 1);
 
-		if (verb == "Quit") {
+		if (verb == "Output") {
+			// :Output <hex bytes>
+			const std::string hex = space == std::string::npos? "" : message.substr(space + 1);
+			if (hex.size() % 2 != 0) {
+				DBG("Invalid output message [" << message << "]");
+				return;
+			}
+
+			std::string bytes;
+			bytes.reserve(hex.size() / 2);
+			for (size_t i = 0; i < hex.size(); i += 2) {
+				Word byte;
+				if (!Util::parseLong(hex.substr(i, 2), byte, 16)) {
+					DBG("Invalid output message [" << message << "]");
+					return;
+				}
+				bytes += static_cast<char>(byte);
+			}
+
+			handleOutput(bytes);
+		} else if (verb == "Quit") {
 			stop();
 			std::exit(0);
 		}
 	}
+
+	void OutputMode::handleOutput(std::string_view bytes) {
+		std::cout.write(bytes.data(), bytes.size());
+		std::cout.flush();
+	}
 }
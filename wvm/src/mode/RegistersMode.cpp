@@ -68,7 +68,8 @@ namespace WVM::Mode {
 		expando->draw();
 		terminal.watchSize();
 		*buffer << ":Registers raw\n";
-		*buffer << ":Subscribe registers\n";
+		// Redrawing faster than this wouldn't be visible, and sampling keeps fast-forwarding at full speed.
+		*buffer << ":Subscribe registers sample 30\n";
 		terminal.join();
 		networkThread.join();
 	}
@@ -153,6 +154,23 @@ namespace WVM::Mode {
 			} else if (ready) {
 				updateLine(reg);
 			}
+		} else if (verb == "RegisterSnapshot") {
+			Word reg, value;
+			if (size % 2 != 0) {
+				DBG("Invalid: RegisterSnapshot[" << rest << "]");
+				return;
+			}
+
+			for (size_t i = 0; i < size; i += 2) {
+				if (!Util::parseLong(split[i], reg) || !Util::parseLong(split[i + 1], value) || reg < 0 || 128 <= reg) {
+					DBG("Invalid: RegisterSnapshot[" << rest << "]");
+					return;
+				}
+
+				registers[reg] = value;
+				if (ready)
+					updateLine(reg);
+			}
 		} else if (verb == "FastForward") {
 			if (size != 1) {
 				DBG("Invalid: FastForward[" << rest << "]");
@@ -0,0 +1,66 @@
+#include <fstream>
+#include <iostream>
+
+#include <signal.h>
+
+#include "mode/RunMode.h"
+#include "Util.h"
+
+namespace WVM::Mode {
+	RunMode * RunMode::instance = nullptr;
+
+	int RunMode::run(const std::string &path, const std::vector<std::string> &disks) {
+		instance = this;
+		vm.onPrint = [](const std::string &str) { std::cout << str << std::flush; };
+		vm.load(path, disks);
+		signal(SIGINT, +[](int) {
+			if (instance)
+				instance->stop();
+		});
+
+		if (profile)
+			vm.profiler.start();
+
+		if (!foldedPath.empty())
+			vm.sampler.start(sampleInterval);
+
+		int status = 0;
+		vm.start();
+		try {
+			PerfCounters::Stopwatch watch(vm.counters.hostRunning, vm.counters.runningSince);
+			// Partial lines of output would otherwise wait for the next print.
+			for (UWord ticks = 1; vm.tick(); ++ticks)
+				if (ticks % FLUSH_TICKS == 0)
+					vm.flushOutput();
+		} catch (const std::exception &err) {
+			vm.flushOutput();
+			error() << "Execution failed at " << vm.symbolize(vm.programCounter) << ": " << err.what() << '\n';
+			status = 1;
+		}
+
+		vm.flushOutput();
+
+		if (profile) {
+			vm.profiler.stop();
+			std::cerr << '\n';
+			vm.profiler.report(std::cerr);
+		}
+
+		if (!foldedPath.empty()) {
+			vm.sampler.stop();
+			std::ofstream stream(foldedPath);
+			if (!stream) {
+				error() << "Couldn't open " << foldedPath << " for writing.\n";
+				return 1;
+			}
+			vm.sampler.writeFolded(stream);
+			info() << "Wrote " << vm.sampler.getSamples() << " samples to " << foldedPath << ".\n";
+		}
+
+		return status;
+	}
+
+	void RunMode::stop() {
+		vm.stop();
+	}
+}
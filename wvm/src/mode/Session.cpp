@@ -0,0 +1,1740 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "lib/ansi.h"
+#include "mode/ServerMode.h"
+#include "mode/Session.h"
+#include "net/Binary.h"
+#include "Operations.h"
+#include "Unparser.h"
+#include "Util.h"
+#include "VMError.h"
+
+#define CATCH_TICK
+
+namespace WVM::Mode {
+	void Session::initVM() {
+		vm.onWake = [this] { wake(); };
+
+		vm.onUpdateMemory = [this](Word, Word, Word unadjusted, Size size) {
+			if (logMemoryWrites)
+				DBG("[" << unadjusted << "] <- " << vm.get(unadjusted, size));
+		};
+
+		vm.onRegisterChange = [this](unsigned char id) {
+			if (logRegisters)
+				DBG(Why::coloredRegister(id) << " <- " << vm.registers[id]);
+			changedRegisters.set(id);
+			if (holdingUpdates) {
+				heldRegisters.set(id);
+				return;
+			}
+			if (registerSubscribers.empty() && !sharing)
+				return;
+			if (std::this_thread::get_id() == executorID.load(std::memory_order_relaxed)) {
+				publish({Event::Kind::Register, id, vm.registers[id]});
+			} else {
+				// Interrupts from other threads are rare, so they're sent directly after anything already queued.
+				drainEvents();
+				auto lock = lockSubscribers();
+				sendRegister(id, vm.registers[id]);
+			}
+		};
+
+		vm.onJump = [this](Word, Word to) {
+			if (holdingUpdates || (pcSubscribers.empty() && !sharing))
+				return;
+			if (std::this_thread::get_id() == executorID.load(std::memory_order_relaxed)) {
+				publish({Event::Kind::PC, 0, to});
+			} else {
+				drainEvents();
+				auto lock = lockSubscribers();
+				sendPC(to);
+			}
+		};
+
+		vm.onPrint = [this](const std::string &str) {
+			if (outputSubscribers.empty())
+				return;
+			bool full;
+			{
+				auto lock = lockOutput();
+				queuedOutput += str;
+				full = MAX_QUEUED_OUTPUT <= queuedOutput.size();
+				outputQueued = true;
+			}
+			if (full)
+				drainEvents();
+			else
+				requestDrain();
+		};
+
+		vm.onAddBreakpoint = [this](Word breakpoint) {
+			const std::string message = ":AddBP " + std::to_string(breakpoint);
+			auto lock = lockSubscribers();
+			for (int client: bpSubscribers)
+				server.send(client, message);
+		};
+
+		vm.onRemoveBreakpoint = [this](Word breakpoint) {
+			const std::string message = ":RemoveBP " + std::to_string(breakpoint);
+			auto lock = lockSubscribers();
+			for (int client: bpSubscribers)
+				server.send(client, message);
+		};
+
+		vm.onWatchpoint = [this](const Watchpoint &watchpoint, Word address, Word pc, bool write) {
+			broadcast(":Watch " + std::to_string(watchpoint.address) + " " + std::to_string(address) + " " +
+				(write? "w" : "r") + " " + std::to_string(pc));
+		};
+
+		vm.onPagingChange = [this](bool enabled) {
+			const std::string message = ":Paging " + std::string(enabled? "enabled" : "disabled");
+			auto lock = lockSubscribers();
+			for (int client: pagingSubscribers)
+				server.send(client, message);
+		};
+
+		vm.onP0Change = [this](Word addr) {
+			const std::string message = ":P0 " + std::to_string(addr);
+			auto lock = lockSubscribers();
+			for (int client: p0Subscribers)
+				server.send(client, message);
+		};
+	}
+
+	Session::Session(ServerMode &host_, Net::Server &server_, UWord id_):
+		id(id_), host(host_), server(server_), vm(2 * 134'217'728) {}
+
+	void Session::load(const std::string &path, const std::vector<std::string> &disks) {
+		vm.load(path, disks);
+		initVM();
+	}
+
+	void Session::create(int client, const std::string &path, const std::vector<std::string> &disks) {
+		{
+			auto lock = lockCommands();
+			image = Image {client, path, disks};
+			interrupted = true;
+		}
+		wake();
+	}
+
+	void Session::forkFrom(Session &parent, const VM::Snapshot &snapshot) {
+		vm.forkFrom(parent.vm, snapshot);
+		initVM();
+
+		if (parent.currentRun && parent.currentRun->kind == Run::Kind::Play) {
+			currentRun.emplace(Run::Kind::Play, parent.currentRun->client);
+			currentRun->delay = parent.currentRun->delay;
+			wake();
+		}
+	}
+
+	void Session::cleanupClient(int client) {
+		auto lock = lockSubscribers();
+		memorySubscribers.erase(client);
+		if (memoryRates.erase(client) != 0)
+			updateMemoryRate();
+		registerSubscribers.erase(client);
+		pcSubscribers.erase(client);
+		pcSampling.erase(client);
+		registerSampling.erase(client);
+		outputSubscribers.erase(client);
+		ffSubscribers.erase(client);
+		bpSubscribers.erase(client);
+		pagingSubscribers.erase(client);
+		p0Subscribers.erase(client);
+		statsSubscribers.erase(client);
+		std::unique_lock stale_lock(staleMutex);
+		staleMemory.erase(client);
+	}
+
+	void Session::post(int client, const std::string &message) {
+		{
+			auto lock = lockCommands();
+			commands.emplace_back(client, message);
+			interrupted = true;
+		}
+		wake();
+	}
+
+	void Session::wake() {
+		if (destroyed || scheduled.exchange(true))
+			return;
+		// Interrupts can wake the VM while the session is being destroyed.
+		if (std::shared_ptr<Session> self = weak_from_this().lock())
+			host.schedule(std::move(self));
+		else
+			scheduled = false;
+	}
+
+	bool Session::runnable() const {
+		return !destroyed && (interrupted || (parked && !vm.resting));
+	}
+
+	void Session::destroy() {
+		destroyed = true;
+		interrupted = true;
+	}
+
+	bool Session::runSlice(Clock::time_point deadline) {
+		if (destroyed)
+			return false;
+
+		executorID = std::this_thread::get_id();
+		++slices;
+		if (parked) {
+			auto lock = vm.lockVM();
+			vm.counters.endRest();
+			parked = false;
+		}
+
+		std::optional<Image> to_load;
+		{
+			auto lock = lockCommands();
+			interrupted = false;
+			to_load = std::move(image);
+			image.reset();
+			for (Command &command: commands)
+				pending.push_back(std::move(command));
+			commands.clear();
+		}
+
+		if (to_load) {
+			try {
+				load(to_load->path, to_load->disks);
+				server.send(to_load->client, ":Created " + std::to_string(id));
+			} catch (const std::exception &err) {
+				server.send(to_load->client, ":Error Couldn't load " + to_load->path + ": " + err.what());
+				executorID = std::thread::id();
+				++slices;
+				host.destroySession(id);
+				return false;
+			}
+		}
+
+		for (auto iter = pending.begin(); iter != pending.end() && !destroyed;) {
+			// A client's commands wait for the end of a run it started, except for :Pause.
+			if (currentRun && currentRun->kind != Run::Kind::Play && currentRun->client == iter->client
+			    && iter->message != ":Pause") {
+				++iter;
+				continue;
+			}
+
+			const Command command = std::move(*iter);
+			iter = pending.erase(iter);
+			try {
+				auto lock = vm.lockVM();
+				execute(command.client, command.message);
+			} catch (const std::exception &err) {
+				server.send(command.client, ":Error " + std::string(err.what()));
+			}
+			drainEvents();
+		}
+
+		if (currentRun && !destroyed)
+			continueRun(deadline);
+
+		// Output printed since the last newline is sent at least once per slice.
+		vm.flushOutput();
+		executorID = std::thread::id();
+		++slices;
+		return !destroyed && (interrupted || (currentRun && !parked));
+	}
+
+	void Session::drainQueued() {
+		wakeRequested.store(false, std::memory_order_relaxed);
+		// Pairs with the fence in requestDrain() so that an event is either drained here or wakes the loop again.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!events.empty() || outputQueued.load(std::memory_order_relaxed))
+			drainEvents();
+	}
+
+	void Session::deliverKey() {
+		if (queuedKeys.load(std::memory_order_relaxed) == 0)
+			return;
+		UWord key;
+		{
+			auto lock = lockKeys();
+			if (keys.empty())
+				return;
+			key = keys.front();
+			keys.pop_front();
+			--queuedKeys;
+		}
+		vm.intKeybrd(key);
+	}
+
+	void Session::flushStats(Clock::time_point now) {
+		{
+			// The VM lock waits for the end of a slice, so it's only taken once some client is due.
+			auto lock = lockSubscribers();
+			if (std::none_of(statsSubscribers.begin(), statsSubscribers.end(),
+			                 [now](const auto &pair) { return pair.second.next <= now; }))
+				return;
+		}
+
+		auto vm_lock = vm.lockVM();
+		auto lock = lockSubscribers();
+
+		const std::vector<std::pair<std::string, uint64_t>> current = vm.counters.list();
+		for (auto &[client, subscription]: statsSubscribers) {
+			if (now < subscription.next)
+				continue;
+			subscription.next = now + subscription.interval;
+
+			// Counters that went down since the last deltas were cleared in between and are left out.
+			std::vector<std::pair<std::string, uint64_t>> deltas;
+			for (size_t i = 0; i < current.size() && i < subscription.previous.size(); ++i)
+				if (subscription.previous[i].second < current[i].second)
+					deltas.emplace_back(current[i].first, current[i].second - subscription.previous[i].second);
+			subscription.previous = current;
+			server.send(client, stringifyStats("StatsDelta", deltas));
+		}
+	}
+
+	void Session::sample() {
+		// Nothing changes while a session isn't running, apart from interrupts, which send their changes directly.
+		const UWord current = slices;
+		if (current == sampledSlices && current % 2 == 0)
+			return;
+		sampledSlices = current;
+		if (!holdingUpdates)
+			flushSamples(false);
+	}
+
+	Session::Clock::time_point Session::flushMemoryIfDue(Clock::time_point now) {
+		// Timed from the last flush rather than the next one, so that a subscriber asking for a higher rate takes
+		// effect right away.
+		const auto interval = std::chrono::microseconds(1'000'000 / std::max<UWord>(1, memoryRate.load()));
+		const Clock::time_point due = lastMemory + interval;
+		if (now < due)
+			return due;
+		lastMemory = std::max<Clock::time_point>(due, now - interval);
+		const UWord current = slices;
+		if ((current != memorySlices || current % 2 != 0) && !holdingUpdates) {
+			memorySlices = current;
+			flushMemory();
+		}
+		return lastMemory + interval;
+	}
+
+	void Session::updateMemoryRate() {
+		UWord rate = 0;
+		for (const auto &[client, client_rate]: memoryRates)
+			rate = std::max(rate, client_rate);
+		memoryRate = rate == 0? DEFAULT_MEMORY_RATE : rate;
+	}
+
+	void Session::markStale(int client, Net::Server::Stream stream) {
+		// Memory is only sent on its stream by flushMemory(), which holds the VM lock.
+		if (stream == MemoryStream) {
+			std::unique_lock lock(staleMutex);
+			staleMemory[client] = flushEpoch;
+		}
+	}
+
+	void Session::execute(int client, const std::string &message) {
+		if (message.empty() || message.front() != ':') {
+			server.send(client, ":Error Invalid message");
+			return;
+		}
+
+		const std::vector<std::string> split = Util::split(message, " ");
+		const size_t size = split.size();
+		const std::string verb = split[0].substr(1);
+
+		auto invalid = [&] { server.send(client, ":InvalidMessage " + message); };
+
+		if (verb == "Stop") {
+			host.stop();
+		} else if (verb == "Play") {
+			UWord microdelay = 0;
+			if (2 < size) {
+				invalid();
+				return;
+			}
+
+			if (size == 2 && !Util::parseUL(split[1], microdelay)) {
+				server.send(client, ":Error Invalid delay.");
+				return;
+			}
+
+			// Playing while already playing does nothing.
+			if (currentRun && currentRun->kind == Run::Kind::Play)
+				return;
+			if (!canStartRun(client))
+				return;
+
+			vm.paused = false;
+			vm.start();
+			currentRun.emplace(Run::Kind::Play, client);
+			currentRun->delay = std::chrono::microseconds(microdelay);
+			setFastForward(true);
+			broadcast(":Log Playing...");
+		} else if (verb == "Pause") {
+			if (size != 1)
+				invalid();
+			else if (currentRun)
+				endRun();
+		} else if (verb == "Subscribe") {
+			// PC and register subscriptions take a mode: every, sample <hz> or onpause.
+			const bool has_mode = 2 < size && (split[1] == "pc" || split[1] == "registers");
+			if (size < 2 || 4 < size || (size == 4 && !has_mode)
+			    || (size == 3 && !has_mode && split[1] != "stats" && split[1] != "memory")) {
+				invalid();
+				return;
+			}
+
+			const std::string &to = split[1];
+			if (to == "memory") {
+				UWord rate = DEFAULT_MEMORY_RATE;
+				if (size == 3 && (!Util::parseUL(split[2], rate) || rate == 0)) {
+					invalid();
+					return;
+				}
+				{
+					auto vm_lock = vm.lockVM();
+					if (!vm.dirtyWords.isEnabled()) {
+						vm.dirtyWords.enable(vm.getMemorySize());
+						flushEpoch = vm.beginEpoch();
+					}
+				}
+				// Memory is drained once for every subscriber, so it's sent as often as the most eager one asks.
+				auto lock = lockSubscribers();
+				memorySubscribers.insert(client);
+				memoryRates[client] = rate;
+				updateMemoryRate();
+				ffSubscribers.insert(client);
+				server.send(client, ":MemorySize " + std::to_string(vm.getMemorySize()));
+			} else if (to == "registers" || to == "pc") {
+				std::optional<Sampling> sampling;
+				if (!parseSampling(split, 2, sampling)) {
+					invalid();
+					return;
+				}
+				auto vm_lock = vm.lockVM();
+				auto lock = lockSubscribers();
+				auto &subscribers = to == "pc"? pcSubscribers : registerSubscribers;
+				auto &samplings = to == "pc"? pcSampling : registerSampling;
+				subscribers.erase(client);
+				samplings.erase(client);
+				if (sampling) {
+					sampling->lastPC = vm.programCounter;
+					samplings.emplace(client, *sampling);
+				} else {
+					subscribers.insert(client);
+				}
+				if (to == "pc")
+					server.send(client, ":PC " + std::to_string(vm.programCounter));
+				ffSubscribers.insert(client);
+			} else if (to == "output") {
+				auto lock = lockSubscribers();
+				outputSubscribers.insert(client);
+			} else if (to == "bp" || to == "breakpoints") {
+				auto lock = lockSubscribers();
+				bpSubscribers.insert(client);
+				for (int breakpoint: vm.getBreakpoints())
+					server.send(client, ":AddBP " + std::to_string(breakpoint));
+			} else if (to == "paging") {
+				auto lock = lockSubscribers();
+				pagingSubscribers.insert(client);
+				server.send(client, ":Paging " + std::string(vm.pagingOn? "enabled" : "disabled"));
+			} else if (to == "p0") {
+				auto lock = lockSubscribers();
+				p0Subscribers.insert(client);
+				server.send(client, ":P0 " + std::to_string(vm.p0));
+			} else if (to == "stats") {
+				UWord interval = 1000;
+				if (size == 3 && (!Util::parseUL(split[2], interval) || interval == 0)) {
+					invalid();
+					return;
+				}
+				// Each client gets deltas at its own interval, counted from when it subscribed.
+				auto lock = lockSubscribers();
+				statsSubscribers.insert_or_assign(client,
+					StatsSubscription(std::chrono::milliseconds(interval), vm.counters.list()));
+			} else {
+				invalid();
+				return;
+			}
+
+			server.send(client, ":Subscribed " + to);
+		} else if (verb == "GetMain") {
+			if (size == 1) {
+				sendMemory(client);
+			} else {
+				UWord since;
+				if (size != 3 || split[1] != "since" || !Util::parseUL(split[2], since) || since == 0) {
+					invalid();
+					return;
+				}
+				sendMemory(client, since);
+			}
+		} else if (verb == "Init") {
+			vm.init();
+		} else if (verb == "Tick") {
+			if (vm.paused) {
+				broadcast(":Paused");
+			} else if (size == 1) {
+				tick();
+				flushStopped();
+				if (vm.paused)
+					broadcast(":Paused");
+			} else if (size == 2) {
+				Word ticks;
+				if (!Util::parseLong(split[1], ticks)) {
+					invalid();
+					return;
+				}
+
+				if (!canStartRun(client))
+					return;
+
+				server.send(client, ":Log Ticking...");
+				setFastForward(true);
+				vm.start();
+				currentRun.emplace(Run::Kind::Ticks, client);
+				currentRun->ticks = std::max<Word>(0, ticks);
+			} else {
+				invalid();
+			}
+		} else if (verb == "StepOver" || verb == "StepOut" || verb == "RunTo") {
+			if (vm.paused) {
+				broadcast(":Paused");
+				return;
+			}
+
+			Word target, min_sp = 0;
+			if (verb == "RunTo") {
+				if (size != 2) {
+					invalid();
+					return;
+				}
+
+				if (!Util::parseLong(split[1], target) && (target = vm.symbolAddress(split[1])) == -1) {
+					server.send(client, ":Error Symbol not found.");
+					return;
+				}
+			} else if (size != 1) {
+				invalid();
+				return;
+			} else if (verb == "StepOver") {
+				bool success;
+				const Word translated = vm.translateAddress(vm.programCounter, &success);
+				if (!success || !Operations::isCall(vm.getWord(translated, Endianness::Big))) {
+					// Anything other than a call is stepped over by executing it.
+					const UWord ticked = tick()? 1 : 0;
+					flushStopped();
+					server.send(client, ":Stepped " + std::to_string(ticked) + " " + std::to_string(vm.programCounter));
+					if (vm.paused)
+						broadcast(":Paused");
+					return;
+				}
+
+				target = vm.programCounter + 8;
+				min_sp = vm.sp();
+			} else {
+				target = returnAddress();
+				if (target == -1) {
+					server.send(client, ":Error Couldn't find the return address.");
+					return;
+				}
+				min_sp = vm.sp();
+			}
+
+			if (!canStartRun(client))
+				return;
+
+			setFastForward(true);
+			holdingUpdates = true;
+			vm.start();
+			vm.addTemporaryBreakpoint(target);
+			currentRun.emplace(Run::Kind::Until, client);
+			currentRun->target = target;
+			currentRun->minSP = min_sp;
+		} else if (verb == "Unpause") {
+			vm.paused = false;
+			broadcast(":Unpaused");
+		} else if (verb == "Reg") {
+			if (size != 2 && size != 3) {
+				invalid();
+				return;
+			}
+
+			Word reg;
+			if (!Util::parseLong(split[1], reg) && (reg = Why::registerID(split[1])) == -1) {
+				server.send(client, ":Error Invalid register: " + split[1]);
+				return;
+			}
+
+			if (size == 3) {
+				UWord new_value;
+				if (!Util::parseUL(split[2], new_value)) {
+					invalid();
+					return;
+				}
+
+				vm.registers[reg] = new_value;
+			}
+
+			server.send(client, ":Register " + std::to_string(reg) + " " + std::to_string(vm.registers[reg]));
+		} else if (verb == "PrintOps") {
+			if (size != 2) {
+				invalid();
+				return;
+			}
+
+			Word count;
+			if (!Util::parseLong(split[1], count)) {
+				invalid();
+				return;
+			}
+
+			for (Word address = vm.programCounter, i = 0; i < count; ++i, address += 8) {
+				bool success = false;
+				Word translated = vm.translateAddress(address, &success);
+				if (!success) {
+					std::cout << "Couldn't translate " << address << ".\n";
+					break;
+				}
+				std::cout << address << ": " << Unparser::stringify(vm.getInstruction(translated), &vm) << '\n';
+			}
+		} else if (verb == "Symbols") {
+			for (const auto &[name, symbol]: vm.symbolTable)
+				std::cout << "\e[1m" << name << "\e[22m: " << symbol.location << " \e[22;2m[" << std::hex << symbol.hash
+				          << std::dec << "]\e[22m\n";
+		} else if (verb == "GetWord") {
+			if (size != 2 && size != 3) {
+				invalid();
+				return;
+			}
+
+			UWord address;
+			if (!Util::parseUL(split[1], address)) {
+				invalid();
+				return;
+			}
+
+			Endianness endianness = Endianness::Little;
+			if (size == 3) {
+				if (split[2] == "B") {
+					endianness = Endianness::Big;
+				} else if (split[2] != "L") {
+					invalid();
+					return;
+				}
+			}
+
+			server.send(client, ":MemoryWord " + std::to_string(address) + " " +
+				std::to_string(vm.getWord(address, endianness)) + " " + static_cast<char>(endianness));
+		} else if (verb == "GetWords") {
+			// :GetWords <address|symbol> <count> replies with the words little-endian, like :GetMain.
+			Word address;
+			UWord count;
+			if (size != 3 || !Util::parseUL(split[2], count)) {
+				invalid();
+				return;
+			}
+
+			if (!Util::parseLong(split[1], address) && (address = vm.symbolAddress(split[1])) == -1) {
+				server.send(client, ":Error Symbol not found.");
+				return;
+			}
+
+			if (address < 0 || vm.getMemorySize() / 8 < count || vm.getMemorySize() - count * 8 < UWord(address)) {
+				server.send(client, ":Error Out of range.");
+				return;
+			}
+
+			std::stringstream to_send;
+			to_send << ":MemoryWords " << address << " " << count << std::hex;
+			for (UWord i = 0; i < count; ++i)
+				to_send << " " << vm.getWord(address + 8 * i, Endianness::Little);
+			server.send(client, to_send.str());
+		} else if (verb == "SetWord") {
+			if (size != 3 && size != 4) {
+				invalid();
+				return;
+			}
+
+			UWord address, value;
+			if (!Util::parseUL(split[1], address) || !Util::parseUL(split[2], value)) {
+				invalid();
+				return;
+			}
+
+			Endianness endianness = Endianness::Little;
+			if (size == 4) {
+				if (split[3] == "B") {
+					endianness = Endianness::Big;
+				} else if (split[3] != "L") {
+					invalid();
+					return;
+				}
+			}
+
+			vm.setWord(address, value, endianness);
+			server.send(client, ":MemoryWord " + std::to_string(address) + " " +
+				std::to_string(vm.getWord(address, endianness)) + " " + static_cast<char>(endianness));
+		} else if (verb == "GetPC") {
+			if (size != 1)
+				invalid();
+			else
+				server.send(client, ":PC " + std::to_string(vm.programCounter));
+		} else if (verb == "SetPC") {
+			Word address;
+			if (size != 2 || !Util::parseLong(split[1], address))
+				invalid();
+			else
+				vm.jump(address);
+		} else if (verb == "GetString") {
+			if (size != 2) {
+				invalid();
+				return;
+			}
+
+			Word address;
+			if (!Util::parseLong(split[1], address)) {
+				// Look up from the symbol table.
+				if (vm.symbolTable.count(split[1]) == 0)
+					server.send(client, ":Error GetString: unknown symbol: " + split[1]);
+				else
+					address = vm.symbolTable.at(split[1]).location;
+			}
+		} else if (verb == "Registers") {
+			if (size == 2 && split[1] == "raw")
+				for (int i = 0; i < Why::totalRegisters; ++i)
+					server.send(client, ":Register " + std::to_string(i) + " " + std::to_string(vm.registers[i]));
+			else
+				for (int i = 0; i < Why::totalRegisters; ++i)
+					server.send(client, ":Register $" + Why::registerName(i) + " " + std::to_string(vm.registers[i]));
+		} else if (verb == "Regs") {
+			// :Regs <register>... or :Regs all replies with one :RegisterSnapshot.
+			if (size < 2) {
+				invalid();
+				return;
+			}
+
+			std::bitset<Why::totalRegisters> which;
+			if (size == 2 && split[1] == "all") {
+				which.set();
+			} else {
+				for (size_t i = 1; i < size; ++i) {
+					Word reg;
+					if ((!Util::parseLong(split[i], reg) && (reg = Why::registerID(split[i])) == -1)
+					    || reg < 0 || Why::totalRegisters <= reg) {
+						server.send(client, ":Error Invalid register: " + split[i]);
+						return;
+					}
+					which.set(reg);
+				}
+			}
+
+			sendRegisterSnapshot(client, which, Net::Server::CONTROL);
+		} else if (verb == "Batch") {
+			// :Batch :Verb args... :Verb args... handles each command in order with nothing else happening in between,
+			// then sends ":Done Batch <count>" after their replies.
+			std::vector<std::string> batch;
+			for (size_t i = 1; i < size; ++i) {
+				if (split[i].front() == ':')
+					batch.push_back(split[i]);
+				else if (!batch.empty())
+					batch.back() += " " + split[i];
+				else {
+					invalid();
+					return;
+				}
+			}
+
+			if (batch.empty()) {
+				invalid();
+				return;
+			}
+
+			// Commands that start a run or end the connection would break the batch up.
+			static const std::set<std::string> excluded {":Batch", ":Play", ":StepOver", ":StepOut", ":RunTo", ":Stop",
+				":Close"};
+			for (const std::string &command: batch) {
+				const std::string command_verb = command.substr(0, command.find(' '));
+				if (excluded.count(command_verb) != 0 || (command_verb == ":Tick" && command != ":Tick")) {
+					server.send(client, ":Error " + command_verb + " can't be batched.");
+					return;
+				}
+			}
+
+			for (const std::string &command: batch)
+				execute(client, command);
+			server.send(client, ":Done Batch " + std::to_string(batch.size()));
+		} else if (verb == "Fork") {
+			// :Fork [count] clones the VM into new sessions that share its memory until they write to it and replies
+			// ":Forked <id>...". The forks keep playing if this session is.
+			UWord count = 1;
+			if (2 < size || (size == 2 && (!Util::parseUL(split[1], count) || count == 0))) {
+				invalid();
+				return;
+			}
+
+			if (MAX_FORKS < count) {
+				server.send(client, ":Error At most " + std::to_string(MAX_FORKS) + " sessions can be forked at once.");
+				return;
+			}
+
+			const VM::Snapshot snapshot = vm.snapshot();
+			std::string reply = ":Forked";
+			for (UWord i = 0; i < count; ++i) {
+				std::shared_ptr<Session> fork = host.createSession();
+				fork->forkFrom(*this, snapshot);
+				reply += " " + std::to_string(fork->id);
+			}
+			server.send(client, reply);
+		} else if (verb == "Reset") {
+			vm.reset(false);
+			sendMemory(client);
+			server.send(client, ":PC " + std::to_string(vm.programCounter));
+			server.send(client, ":ResetComplete");
+		} else if (verb == "AddBP") {
+			// :AddBP <address|symbol> [if <expression>] [after <hits>]
+			Word breakpoint;
+			if (size < 2) {
+				invalid();
+				return;
+			}
+
+			if (!Util::parseLong(split[1], breakpoint) && (breakpoint = vm.symbolAddress(split[1])) == -1) {
+				server.send(client, ":Error Function not found.");
+				return;
+			}
+
+			if (size == 2) {
+				vm.addBreakpoint(breakpoint);
+				server.send(client, ":AddedBP " + std::to_string(breakpoint));
+				return;
+			}
+
+			BreakpointRule rule;
+			size_t condition_end = size;
+			if (4 <= size && split[size - 2] == "after") {
+				if (!Util::parseUL(split[size - 1], rule.after)) {
+					invalid();
+					return;
+				}
+				condition_end = size - 2;
+			}
+
+			if (condition_end != 2) {
+				if (split[2] != "if" || condition_end == 3) {
+					invalid();
+					return;
+				}
+
+				std::string expression;
+				for (size_t i = 3; i < condition_end; ++i)
+					expression += (i == 3? "" : " ") + split[i];
+
+				try {
+					rule.condition = BreakCondition::compile(expression, vm);
+				} catch (const std::exception &err) {
+					server.send(client, ":Error " + std::string(err.what()));
+					return;
+				}
+			}
+
+			const std::string description = rule.describe();
+			vm.addBreakpoint(breakpoint, std::move(rule));
+			server.send(client, ":AddedBP " + std::to_string(breakpoint) + " " + description);
+		} else if (verb == "RemoveBP") {
+			Word breakpoint;
+			if (size != 2 || !Util::parseLong(split[1], breakpoint))
+				invalid();
+			else
+				vm.removeBreakpoint(breakpoint);
+		} else if (verb == "AddWatch") {
+			if (size != 3 && size != 4) {
+				invalid();
+				return;
+			}
+
+			Word address, length;
+			if (!Util::parseLong(split[1], address) && (address = vm.symbolAddress(split[1])) == -1) {
+				server.send(client, ":Error Symbol not found.");
+				return;
+			}
+
+			if (!Util::parseLong(split[2], length) || length <= 0 || address < 0) {
+				invalid();
+				return;
+			}
+
+			Watchpoint::Access access = Watchpoint::Write;
+			if (size == 4) {
+				if (split[3] == "r") {
+					access = Watchpoint::Read;
+				} else if (split[3] == "rw" || split[3] == "wr") {
+					access = Watchpoint::ReadWrite;
+				} else if (split[3] != "w") {
+					invalid();
+					return;
+				}
+			}
+
+			vm.addWatchpoint(address, length, access);
+			server.send(client, ":AddedWatch " + std::to_string(address) + " " + std::to_string(length) + " " +
+				(access == Watchpoint::Read? "r" : access == Watchpoint::Write? "w" : "rw"));
+		} else if (verb == "RemoveWatch") {
+			Word address;
+			if (size != 2 || !Util::parseLong(split[1], address))
+				invalid();
+			else if (vm.removeWatchpoint(address))
+				server.send(client, ":RemovedWatch " + std::to_string(address));
+			else
+				server.send(client, ":Error No watchpoint at " + std::to_string(address) + ".");
+		} else if (verb == "AskAbout") {
+			Word address;
+			if (size < 2 || 3 < size || !Util::parseLong(split[1], address))
+				invalid();
+			else
+				try {
+					if (size == 3 && split[2] == "t")
+						address = vm.translateAddress(address);
+					const Word word = vm.getWord(address);
+					server.send(client, ":Log " + std::to_string(address) + ": " +
+						std::to_string(vm.getByte(address)) + ", " + std::to_string(vm.getHalfword(address)) + " & " +
+						std::to_string(vm.getHalfword(address + 4)) + "; " + std::to_string(word) + " == " +
+						Util::toHex(word));
+				} catch (const std::exception &err) {
+					server.send(client, ":Error " + std::string(err.what()));
+				}
+		} else if (verb == "Undo") {
+			vm.undo();
+		} else if (verb == "Redo") {
+			vm.redo();
+		} else if (verb == "LogMemoryWrites") {
+			logMemoryWrites = !logMemoryWrites;
+			server.send(client, ":LogMemoryWrites " + std::string(logMemoryWrites? "on" : "off"));
+		} else if (verb == "LogRegisters") {
+			logRegisters = !logRegisters;
+			server.send(client, ":LogRegisters " + std::string(logRegisters? "on" : "off"));
+		} else if (verb == "Strict") { // useful if you want to mess with registers.
+			if (size == 1) {
+				vm.strict = !vm.strict;
+			} else if (size == 2) {
+				if (split[1] == "off" || split[1] == "0" || split[1] == "false" || split[1] == "no") {
+					vm.strict = false;
+				} else if (split[1] == "on" || split[1] == "1" || split[1] == "true" || split[1] == "yes") {
+					vm.strict = true;
+				} else {
+					invalid();
+					return;
+				}
+			} else {
+				invalid();
+				return;
+			}
+
+			server.send(client, ":Strict " + std::string(vm.strict? "on" : "off"));
+		} else if (verb == "GetPC") {
+			server.send(client, ":PC " + std::to_string(vm.programCounter));
+		} else if (verb == "DebugMap") {
+			if (vm.debugMap.empty())
+				warn() << "The debug map is empty.\n";
+			else
+				for (const auto &[address, debug]: vm.debugMap)
+					info() << address << ": " << std::string(debug) << '\n';
+		} else if (verb == "DebugData") {
+			Word address = vm.programCounter;
+			if (size != 1) {
+				if (split[1] == "all") {
+					std::cerr << "Debug map entries: " << vm.debugMap.size() << '\n';
+					for (const auto &[offset, data]: vm.debugMap)
+						std::cerr << offset << ": " << std::string(data) << '\n';
+					std::cerr.flush();
+					return;
+				}
+
+				if (!Util::parseLong(split[1], address)) {
+					invalid();
+					return;
+				}
+			}
+
+			if (vm.debugMap.count(address) == 0)
+				broadcast(":Debug " + std::to_string(address) + " Not found");
+			else
+				broadcast(":Debug " + std::to_string(address) + " " + std::string(vm.debugMap.at(address)));
+		} else if (verb == "SetReg") {
+			if (size != 3) {
+				invalid();
+				return;
+			}
+
+			const int reg = Why::registerID(split[1]);
+			if (reg == -1) {
+				server.send(client, ":Error Invalid register.");
+				return;
+			}
+
+			Word new_value;
+			if (!Util::parseLong(split[2], new_value)) {
+				invalid();
+				return;
+			}
+
+			vm.bufferChange<RegisterChange>(vm, reg, new_value);
+			vm.registers[reg] = new_value;
+			vm.onRegisterChange(reg);
+			server.send(client, ":SetReg " + std::to_string(reg) + " " + std::to_string(new_value));
+		} else if (verb == "History") {
+			if (size == 1) {
+				server.send(client, ":Log History recording is " + std::string(vm.enableHistory? "on" : "off") + ".");
+				return;
+			} else if (size != 2) {
+				invalid();
+				return;
+			} else if (split[1] == "on") {
+				vm.enableHistory = true;
+			} else if (split[1] == "off") {
+				vm.enableHistory = false;
+			} else if (split[1] == "toggle") {
+				vm.enableHistory = !vm.enableHistory;
+			} else {
+				invalid();
+				return;
+			}
+
+			broadcast(":Log History recording turned " + std::string(vm.enableHistory? "on" : "off") + ".");
+		} else if (verb == "Keybrd") {
+			UWord key;
+			if (size != 2 || !Util::parseUL(split[1], key, 16)) {
+				invalid();
+				return;
+			}
+			auto lock = lockKeys();
+			keys.push_back(key);
+			++queuedKeys;
+		} else if (verb == "Dump") {
+			Word address, length;
+			if ((size != 3 && size != 4) || !Util::parseLong(split[1], address) || !Util::parseLong(split[2], length)) {
+				invalid();
+				return;
+			}
+
+			if (length <= 0) {
+				invalid();
+				return;
+			}
+
+			try {
+				if (size == 4 && (split[3] == "t" || split[3] == "tr" || split[3] == "rt"))
+					address = vm.translateAddress(address);
+
+				if (size == 4 && (split[3] == "r" || split[3] == "tr" || split[3] == "rt"))
+					for (Word i = length - 1; 0 <= i; --i)
+						std::cout << Util::toHex(vm.memory.at(address + i), 2).substr(2);
+				else
+					for (Word i = 0; i < length; ++i)
+						std::cout << Util::toHex(vm.memory.at(address + i), 2).substr(2);
+
+				std::cout << std::endl;
+			} catch (const std::exception &err) {
+				error() << "Failed to dump memory (address=" << address << ", length=" << length << "): "
+				        << err.what() << std::endl;
+			}
+		} else if (verb == "Profile") {
+			if (size < 2 || 3 < size || (size == 3 && split[1] != "report")) {
+				invalid();
+				return;
+			}
+
+			const std::string &action = split[1];
+			if (action == "start") {
+				vm.profiler.start();
+				server.send(client, ":Profile started");
+			} else if (action == "stop") {
+				vm.profiler.stop();
+				server.send(client, ":Profile stopped");
+			} else if (action == "clear") {
+				vm.profiler.clear();
+				server.send(client, ":Profile cleared");
+			} else if (action == "report") {
+				UWord rows = 20;
+				if (size == 3 && !Util::parseUL(split[2], rows)) {
+					invalid();
+					return;
+				}
+
+				std::stringstream ss;
+				vm.profiler.report(ss, rows);
+				std::string line;
+				while (std::getline(ss, line))
+					server.send(client, ":Log " + line);
+				server.send(client, ":Done Profile");
+			} else
+				invalid();
+		} else if (verb == "Sample") {
+			if (size < 2) {
+				invalid();
+				return;
+			}
+
+			const std::string &action = split[1];
+			if (action == "start" || action == "timed") {
+				UWord value = 1000;
+				if (3 < size || (size == 3 && (!Util::parseUL(split[2], value) || value == 0))) {
+					invalid();
+					return;
+				}
+
+				if (action == "start") {
+					vm.sampler.start(value);
+					server.send(client, ":Sample started every " + std::to_string(value) + " instructions");
+				} else {
+					const UWord hz = vm.sampler.startTimed(value);
+					server.send(client, ":Sample started at " + std::to_string(hz) + " Hz");
+				}
+			} else if (action == "stop" && size == 2) {
+				vm.sampler.stop();
+				server.send(client, ":Sample stopped after " + std::to_string(vm.sampler.getSamples()) + " samples");
+			} else if (action == "clear" && size == 2) {
+				auto lock = vm.lockVM();
+				vm.sampler.clear();
+				server.send(client, ":Sample cleared");
+			} else if (action == "report" && size == 2) {
+				// The folded stacks are sent back as :Log lines rather than written on the server's side.
+				std::stringstream ss;
+				{
+					auto lock = vm.lockVM();
+					vm.sampler.writeFolded(ss);
+				}
+				std::string line;
+				while (std::getline(ss, line))
+					server.send(client, ":Log " + line);
+				server.send(client, ":Done Sample");
+			} else
+				invalid();
+		} else if (verb == "Stats") {
+			if (size == 2 && split[1] == "clear") {
+				auto lock = vm.lockVM();
+				vm.counters.clear();
+				// Deltas start over from zero instead of being taken against the counters from before.
+				auto subscriber_lock = lockSubscribers();
+				const std::vector<std::pair<std::string, uint64_t>> cleared = vm.counters.list();
+				for (auto &[stats_client, subscription]: statsSubscribers)
+					subscription.previous = cleared;
+			} else if (size != 1) {
+				invalid();
+				return;
+			}
+
+			std::vector<std::pair<std::string, uint64_t>> counters;
+			{
+				auto lock = vm.lockVM();
+				counters = vm.counters.list();
+			}
+			server.send(client, stringifyStats("Stats", counters));
+		} else if (verb == "QueueLimit") {
+			UWord limit;
+			if (size != 2 || !Util::parseUL(split[1], limit)) {
+				invalid();
+				return;
+			}
+
+			server.setQueueLimit(client, limit);
+			server.send(client, ":QueueLimit " + std::to_string(limit));
+		} else if (verb == "Overflow") {
+			static const std::map<std::string, EventStream> streams {
+				{"memory", MemoryStream}, {"pc", PCStream}, {"registers", RegisterStream}, {"output", OutputStream},
+			};
+			static const std::map<std::string, Net::Server::Overflow> policies {
+				{"drop", Net::Server::Overflow::DropOldest},
+				{"coalesce", Net::Server::Overflow::Coalesce},
+				{"disconnect", Net::Server::Overflow::Disconnect},
+			};
+
+			if (size != 3 || streams.count(split[1]) == 0 || policies.count(split[2]) == 0) {
+				invalid();
+				return;
+			}
+
+			// Output can't be reconstructed after the fact.
+			if (split[1] == "output" && split[2] == "coalesce") {
+				server.send(client, ":Error Output can't be coalesced.");
+				return;
+			}
+
+			server.setOverflow(client, streams.at(split[1]), policies.at(split[2]));
+			server.send(client, ":Overflow " + split[1] + " " + split[2]);
+		} else if (verb == "Binary") {
+			if (size != 2 || (split[1] != "on" && split[1] != "off")) {
+				invalid();
+				return;
+			}
+
+			// The acknowledgement is the last message sent in the old format.
+			server.setBinary(client, split[1] == "on", ":Binary " + split[1]);
+		} else if (verb == "Shared") {
+			// Clients on the same host can map guest memory and the register state instead of having them sent. They
+			// open the files through /proc/<pid>/fd/<descriptor>.
+			if (size != 1) {
+				invalid();
+				return;
+			}
+
+			if (vm.memory.isForked()) {
+				server.send(client, ":Error Forked memory can't be shared.");
+				return;
+			}
+
+			auto lock = lockSubscribers();
+			if (!sharedState) {
+				if (!vm.dirtyWords.isEnabled()) {
+					vm.dirtyWords.enable(vm.getMemorySize());
+					flushEpoch = vm.beginEpoch();
+				}
+				sharedState = Net::SharedState::create();
+				sharedState->setMemorySize(vm.getMemorySize());
+				for (int id = 0; id < Why::totalRegisters; ++id)
+					sharedState->setRegister(id, vm.registers[id]);
+				sharedState->setPC(vm.programCounter);
+				sharing = true;
+			}
+
+			server.send(client, ":Shared " + std::to_string(::getpid()) + " " +
+				std::to_string(vm.memory.getDescriptor()) + " " + std::to_string(sharedState->getDescriptor()));
+		} else if (verb == "NetStats") {
+			if (size != 1) {
+				invalid();
+				return;
+			}
+
+			const Net::Server::Stats stats = server.getStats();
+			// Retries after EAGAIN and partial writes count as system calls too, so a slow client can make buffering
+			// look like it cost calls instead of saving them.
+			const uint64_t saved = stats.syscalls < stats.unbufferedSyscalls?
+				stats.unbufferedSyscalls - stats.syscalls : 0;
+			server.send(client, stringifyStats("NetStats", {
+				{"messages", stats.messages},
+				{"bytes", stats.bytes},
+				{"syscalls", stats.syscalls},
+				{"saved", saved},
+				{"dropped", stats.dropped},
+			}));
+		} else if (verb == "Stacktrace") {
+			try {
+				size_t i = 0;
+				std::cerr << "Stacktrace:\n";
+				Word m5 = vm.registers[Why::assemblerOffset + 5];
+				std::cerr << "    " << i << ": " << vm.symbolize(vm.registers[Why::returnAddressOffset]) << '\n';
+				while (m5 != 0) {
+					bool success;
+					const Word rt_addr = vm.translateAddress(m5 + 16, &success);
+					if (!success)
+						throw std::runtime_error("Address translation failed");
+					std::cerr << "    " << ++i << ": " << vm.symbolize(vm.getWord(rt_addr)) << std::endl;
+					const Word m5_addr = vm.translateAddress(m5, &success);
+					if (!success)
+						throw std::runtime_error("Address translation failed");
+					m5 = vm.getWord(m5_addr);
+				}
+				if (i == 0)
+					std::cerr << "    (empty)\n";
+			} catch (const std::exception &err) {
+				error() << "Printing stacktrace failed: " << err.what() << std::endl;
+			}
+		} else {
+			server.send(client, ":UnknownVerb " + verb);
+		}
+	}
+
+	void Session::setFastForward(bool to) {
+		auto lock = lockSubscribers();
+		if (to) {
+			for (int subscriber: ffSubscribers)
+				server.send(subscriber, ":FastForward on");
+		} else {
+			for (int subscriber: ffSubscribers)
+				server.send(subscriber, ":FastForward off");
+			const Word pc = vm.programCounter;
+			sendEvent(Net::Server::CONTROL, ffSubscribers, [&] {
+				return ":PC " + std::to_string(pc);
+			}, [&] {
+				return Net::Binary::pc(pc);
+			});
+		}
+	}
+
+	void Session::broadcast(const std::string &message) {
+		auto lock = lockSubscribers();
+		for (int client: host.getClients(id))
+			server.send(client, message);
+	}
+
+	void Session::sendMemory(int client, UWord since) {
+		static constexpr size_t MAX_RUN_WORDS = 4096;
+		auto vm_lock = vm.lockVM();
+		Word image_end = 0;
+		const bool full = since == 0;
+		if (full) {
+			std::stringstream to_send;
+			server.send(client, ":Offsets " + std::to_string(vm.symbolsOffset) + " " + std::to_string(vm.codeOffset) +
+				" " + std::to_string(vm.dataOffset) + " " + std::to_string(vm.endOffset));
+			image_end = vm.endOffset + 128 * 8;
+			to_send << ":MemoryWords 0 " << (image_end / 8) << std::hex;
+			for (Word i = 0; i < image_end; i += 8)
+				to_send << " " << vm.getWord(i, Endianness::Little);
+			server.send(client, to_send.str());
+			// Beyond the image, only the pages the program has written to can be nonzero.
+			since = vm.getLoadEpoch() + 1;
+		}
+
+		const bool binary = server.isBinary(client);
+		vm.changedSince(since, [&](Word address, size_t length) {
+			const Word end = address + length;
+			for (address = std::max(address, image_end); address < end;) {
+				const size_t count = std::min<size_t>(MAX_RUN_WORDS, (end - address) / 8);
+				if (count == 0)
+					break;
+				if (binary)
+					server.sendFrame(client, Net::Binary::memoryRun(address,
+						std::string_view(reinterpret_cast<const char *>(&vm.memory[address]), count * 8)));
+				else
+					server.send(client, stringifyMemoryRun(address, count));
+				address += count * 8;
+			}
+		});
+
+		// The snapshot isn't complete until the pages written past the image have been sent too.
+		if (full)
+			server.send(client, ":Done GetMain");
+		server.send(client, ":Epoch " + std::to_string(vm.beginEpoch()));
+	}
+
+	void Session::flushSamples(bool stopped) {
+		auto vm_lock = vm.lockVM();
+		auto lock = lockSubscribers();
+		if (pcSampling.empty() && registerSampling.empty())
+			return;
+
+		const auto now = std::chrono::steady_clock::now();
+		auto due = [&](Sampling &sampling) {
+			if (sampling.mode == Sampling::Mode::OnPause)
+				return stopped;
+			if (!stopped && now < sampling.next)
+				return false;
+			sampling.next = std::max(sampling.next + sampling.interval, now);
+			return true;
+		};
+
+		const Word pc = vm.programCounter;
+		for (auto &[client, sampling]: pcSampling) {
+			if (!due(sampling) || sampling.lastPC == pc)
+				continue;
+			sampling.lastPC = pc;
+			if (server.isBinary(client))
+				server.sendFrame(client, Net::Binary::pc(pc), PCStream);
+			else
+				server.send(client, ":PC " + std::to_string(pc), false, PCStream);
+		}
+
+		if (changedRegisters.any()) {
+			for (auto &[client, sampling]: registerSampling)
+				sampling.changedRegisters |= changedRegisters;
+			changedRegisters.reset();
+		}
+
+		for (auto &[client, sampling]: registerSampling) {
+			if (sampling.changedRegisters.none() || !due(sampling))
+				continue;
+			sendRegisterSnapshot(client, sampling.changedRegisters, RegisterStream);
+			sampling.changedRegisters.reset();
+		}
+	}
+
+	void Session::sendRegisterSnapshot(int client, const std::bitset<Why::totalRegisters> &which,
+	                                      Net::Server::Stream stream) {
+		std::vector<std::pair<UByte, Word>> snapshot;
+		for (size_t id = 0; id < which.size(); ++id)
+			if (which.test(id))
+				snapshot.emplace_back(id, vm.registers[id]);
+		if (server.isBinary(client)) {
+			server.sendFrame(client, Net::Binary::registerSnapshot(snapshot), stream);
+		} else {
+			std::string message = ":RegisterSnapshot";
+			for (const auto &[id, value]: snapshot)
+				message += " " + std::to_string(id) + " " + std::to_string(value);
+			server.send(client, message, false, stream);
+		}
+	}
+
+	void Session::resume(int client, Net::Server::Stream stream) {
+		if (stream == MemoryStream) {
+			UWord since;
+			{
+				std::unique_lock lock(staleMutex);
+				auto iter = staleMemory.find(client);
+				if (iter == staleMemory.end())
+					return;
+				since = iter->second;
+				staleMemory.erase(iter);
+			}
+			{
+				auto lock = lockSubscribers();
+				if (memorySubscribers.count(client) == 0)
+					return;
+			}
+			sendMemory(client, since);
+		} else if (stream == PCStream) {
+			auto vm_lock = vm.lockVM();
+			auto lock = lockSubscribers();
+			if (pcSubscribers.count(client) == 0 && pcSampling.count(client) == 0)
+				return;
+			if (server.isBinary(client))
+				server.sendFrame(client, Net::Binary::pc(vm.programCounter));
+			else
+				server.send(client, ":PC " + std::to_string(vm.programCounter));
+		} else if (stream == RegisterStream) {
+			auto vm_lock = vm.lockVM();
+			auto lock = lockSubscribers();
+			if (registerSubscribers.count(client) == 0 && registerSampling.count(client) == 0)
+				return;
+			sendRegisterSnapshot(client, std::bitset<Why::totalRegisters>().set(), Net::Server::CONTROL);
+		}
+	}
+
+	void Session::flushStopped() {
+		drainEvents();
+		if (sharing) {
+			// Jumps aren't published while updates are held.
+			auto lock = lockSubscribers();
+			sharedState->setPC(vm.programCounter);
+		}
+		flushMemory();
+		flushSamples(true);
+	}
+
+	bool Session::parseSampling(const std::vector<std::string> &split, size_t index,
+	                               std::optional<Sampling> &sampling) {
+		sampling.reset();
+		if (split.size() <= index || split[index] == "every")
+			return split.size() <= index + 1;
+
+		if (split[index] == "onpause") {
+			if (split.size() != index + 1)
+				return false;
+			sampling.emplace(Sampling::Mode::OnPause);
+			return true;
+		}
+
+		UWord hz;
+		if (split[index] != "sample" || split.size() != index + 2 || !Util::parseUL(split[index + 1], hz) || hz == 0)
+			return false;
+		sampling.emplace(Sampling::Mode::Sample,
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / hz)));
+		return true;
+	}
+
+	std::string Session::stringifyMemoryRun(Word address, size_t count) {
+		std::stringstream ss;
+		ss << ":MemoryRun " << address << " " << count << std::hex;
+		for (size_t i = 0; i < count; ++i)
+			ss << " " << vm.getWord(address + 8 * i, Endianness::Little);
+		return ss.str();
+	}
+
+	void Session::releaseUpdates() {
+		holdingUpdates = false;
+		flushStopped();
+		auto lock = lockSubscribers();
+		for (size_t id = 0; id < heldRegisters.size(); ++id) {
+			if (!heldRegisters.test(id))
+				continue;
+			sendRegister(id, vm.registers[id]);
+		}
+
+		heldRegisters.reset();
+		// Jumps made while updates were held weren't sent at all, so subscribers get the PC the run ended at.
+		sendPC(vm.programCounter);
+	}
+
+	void Session::flushMemory() {
+		auto vm_lock = vm.lockVM();
+		auto lock = lockSubscribers();
+		const size_t memory_size = vm.getMemorySize();
+		bool drained = false;
+		vm.dirtyWords.drain([&](Word address, size_t count) {
+			count = std::min(count, (memory_size - address) / 8);
+			if (count == 0)
+				return;
+			drained = true;
+			if (sharedState)
+				sharedState->memoryChanged(address, count);
+			sendEvent(MemoryStream, memorySubscribers, [&] {
+				return stringifyMemoryRun(address, count);
+			}, [&] {
+				return Net::Binary::memoryRun(address,
+					std::string_view(reinterpret_cast<const char *>(&vm.memory[address]), count * 8));
+			});
+		});
+
+		if (drained)
+			flushEpoch = vm.beginEpoch();
+	}
+
+	bool Session::canStartRun(int client) {
+		if (!currentRun)
+			return true;
+		server.send(client, ":Error The VM is already running.");
+		return false;
+	}
+
+	void Session::continueRun(Clock::time_point deadline) {
+		Run &run = *currentRun;
+		bool running = true;
+		try {
+			PerfCounters::Stopwatch watch(vm.counters.hostRunning, vm.counters.runningSince);
+			for (UWord steps = 1; running && !parked && !interrupted.load(std::memory_order_relaxed); ++steps) {
+				running = step(run);
+				// Other sessions get their turn once the slice is over.
+				if (steps % 1024 == 0 && deadline <= Clock::now())
+					break;
+			}
+		} catch (const std::exception &err) {
+			server.send(run.client, ":Error " + std::string(err.what()));
+			vm.paused = true;
+			running = false;
+		}
+
+		if (parked) {
+			// The time until an interrupt wakes the VM is added to hostIdle by the next slice.
+			auto lock = vm.lockVM();
+			vm.counters.beginRest();
+		}
+
+		if (!running)
+			endRun();
+	}
+
+	bool Session::step(Run &run) {
+		switch (run.kind) {
+			case Run::Kind::Play:
+				if (!vm.getActive() || vm.paused)
+					return false;
+				if (vm.resting) {
+					// The worker moves on to other sessions until an interrupt wakes the VM.
+					parked = true;
+					return true;
+				}
+				tick();
+				++run.ticked;
+				if (run.delay.count() != 0)
+					std::this_thread::sleep_for(run.delay);
+				return vm.getActive() && !vm.paused;
+
+			case Run::Kind::Ticks:
+				if (run.ticks <= run.ticked)
+					return false;
+				try {
+					if (!tick())
+						return false;
+				} catch (VMError &err) {
+					const bool old_strict = vm.strict;
+					vm.strict = false;
+					vm.undo();
+					vm.strict = old_strict;
+					vm.paused = true;
+					return false;
+				}
+				return ++run.ticked < run.ticks;
+
+			case Run::Kind::Until: {
+				const bool running = tick();
+				++run.ticked;
+				if (running)
+					return true;
+				// Stopping anywhere else, or halting, ends the run and leaves the VM however it stopped.
+				if (!vm.paused || vm.programCounter != run.target)
+					return false;
+				vm.paused = false;
+				if (run.minSP <= vm.sp())
+					return false;
+				vm.addTemporaryBreakpoint(run.target);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void Session::endRun() {
+		const Run run = *currentRun;
+		currentRun.reset();
+		auto lock = vm.lockVM();
+		switch (run.kind) {
+			case Run::Kind::Play:
+				flushStopped();
+				setFastForward(false);
+				broadcast(":Log Paused.");
+				break;
+
+			case Run::Kind::Ticks:
+				if (vm.paused)
+					broadcast(":Paused");
+				server.send(run.client, ":Log Ticked " + std::to_string(run.ticked) + " time" +
+					(run.ticked == 1? "" : "s") + ".");
+				DBG("Server ticked " << run.ticked << " time" << (run.ticked == 1? "" : "s") << ".");
+				flushStopped();
+				setFastForward(false);
+				break;
+
+			case Run::Kind::Until:
+				vm.clearTemporaryBreakpoints();
+				releaseUpdates();
+				setFastForward(false);
+				DBG("Server ran " << run.ticked << " instruction" << (run.ticked == 1? "" : "s") << ".");
+				server.send(run.client, ":Stepped " + std::to_string(run.ticked) + " " +
+					std::to_string(vm.programCounter));
+				if (vm.paused)
+					broadcast(":Paused");
+				break;
+		}
+	}
+
+	void Session::publish(const Event &event) {
+		if (!events.push(event)) {
+			// The event loop has fallen behind, so the executor sends everything itself. Sending never blocks.
+			drainEvents();
+			events.push(event);
+		}
+
+		requestDrain();
+	}
+
+	void Session::requestDrain() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!wakeRequested.load(std::memory_order_relaxed) && !wakeRequested.exchange(true))
+			server.wake();
+	}
+
+	void Session::drainEvents() {
+		std::unique_lock drain_lock(drainMutex);
+		auto lock = lockSubscribers();
+		Event event;
+		while (events.pop(event)) {
+			if (event.kind == Event::Kind::Register)
+				sendRegister(event.id, event.value);
+			else
+				sendPC(event.value);
+		}
+
+		std::string output;
+		{
+			auto output_lock = lockOutput();
+			output.swap(queuedOutput);
+			outputQueued = false;
+		}
+		if (!output.empty())
+			sendOutput(output);
+	}
+
+	void Session::sendRegister(UByte id, Word value) {
+		if (sharedState)
+			sharedState->setRegister(id, value);
+		sendEvent(RegisterStream, registerSubscribers, [&] {
+			return ":Register " + std::to_string(id) + " " + std::to_string(value);
+		}, [&] {
+			return Net::Binary::registerValue(id, value);
+		});
+	}
+
+	void Session::sendPC(Word pc) {
+		if (sharedState)
+			sharedState->setPC(pc);
+		sendEvent(PCStream, pcSubscribers, [&] {
+			return ":PC " + std::to_string(pc);
+		}, [&] {
+			return Net::Binary::pc(pc);
+		});
+	}
+
+	void Session::sendOutput(std::string_view str) {
+		for (size_t offset = 0; offset < str.size(); offset += MAX_OUTPUT_MESSAGE) {
+			const std::string_view chunk = str.substr(offset, MAX_OUTPUT_MESSAGE);
+			sendEvent(OutputStream, outputSubscribers, [&] {
+				static constexpr char digits[] = "0123456789abcdef";
+				std::string text = ":Output ";
+				text.reserve(text.size() + 2 * chunk.size());
+				for (const char ch: chunk) {
+					text += digits[UByte(ch) >> 4];
+					text += digits[UByte(ch) & 15];
+				}
+				return text;
+			}, [&] {
+				return Net::Binary::output(chunk);
+			});
+		}
+	}
+
+	Word Session::returnAddress() {
+		auto function = [this](Word address) {
+			const SymbolIndex::Entry *entry = vm.symbolIndex.nearest(address);
+			return entry? entry->address : address;
+		};
+
+		// A $rt pointing back into the current function was left behind by a call the function made itself, so the
+		// real return address has been saved in the frame $m5 points to.
+		const Word rt = vm.rt();
+		const Word m5 = vm.registers[Why::assemblerOffset + 5];
+		if (rt != 0 && (m5 == 0 || function(rt) != function(vm.programCounter)))
+			return rt;
+
+		if (m5 == 0)
+			return -1;
+
+		bool success;
+		const Word rt_addr = vm.translateAddress(m5 + 16, &success);
+		if (!success || rt_addr < 0 || vm.getMemorySize() < size_t(rt_addr) + 8)
+			return -1;
+		return vm.getWord(rt_addr);
+	}
+
+	std::string Session::stringifyStats(const std::string &verb,
+	                                       const std::vector<std::pair<std::string, uint64_t>> &counters) {
+		std::string out = ":" + verb;
+		for (const auto &[name, value]: counters)
+			out += " " + name + "=" + std::to_string(value);
+		return out;
+	}
+
+	bool Session::tick() {
+#ifdef CATCH_TICK
+		const Word pc = vm.programCounter;
+		try {
+#endif
+			return vm.tick();
+#ifdef CATCH_TICK
+		} catch (std::exception &err) {
+			std::cerr << "Execution failed: " << err.what() << "\n";
+			std::cerr << "Offending address: " << pc << "\n";
+			try {
+				Word last = vm.programCounter;
+				for (int i = 0; i < 16; ++i) {
+					vm.undo();
+					if (last != vm.programCounter) {
+						std::cerr << "Previous address: " << vm.programCounter << "\n";
+						last = vm.programCounter;
+					}
+				}
+			} catch (std::exception &undo_err) {
+				std::cerr << "Couldn't rewind.\n";
+			}
+
+			throw;
+		}
+#endif
+	}
+}
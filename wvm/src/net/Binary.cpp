@@ -0,0 +1,88 @@
+#include "net/Binary.h"
+
+namespace WVM::Net::Binary {
+	namespace {
+		void append(std::string &out, UWord value, size_t bytes) {
+			for (size_t i = 0; i < bytes; ++i)
+				out += char((value >> (8 * i)) & 0xff);
+		}
+
+		/** Starts a frame whose body (opcode included) will be body_size bytes long. */
+		std::string start(Opcode opcode, size_t body_size) {
+			std::string out;
+			out.reserve(LENGTH_SIZE + body_size);
+			append(out, body_size, LENGTH_SIZE);
+			out += char(opcode);
+			return out;
+		}
+	}
+
+	std::string text(std::string_view message) {
+		std::string out = start(Opcode::Text, 1 + message.size());
+		out.append(message);
+		return out;
+	}
+
+	std::string memoryWord(UWord address, UWord value, UWord pc, UByte size) {
+		std::string out = start(Opcode::MemoryWord, 1 + 8 + 8 + 8 + 1);
+		append(out, address, 8);
+		append(out, value, 8);
+		append(out, pc, 8);
+		append(out, size, 1);
+		return out;
+	}
+
+	std::string registerValue(UByte id, UWord value) {
+		std::string out = start(Opcode::Register, 1 + 1 + 8);
+		append(out, id, 1);
+		append(out, value, 8);
+		return out;
+	}
+
+	std::string pc(UWord value) {
+		std::string out = start(Opcode::PC, 1 + 8);
+		append(out, value, 8);
+		return out;
+	}
+
+	std::string output(std::string_view bytes) {
+		std::string out = start(Opcode::Output, 1 + bytes.size());
+		out.append(bytes);
+		return out;
+	}
+
+	std::string memoryRun(UWord address, std::string_view bytes) {
+		std::string out = start(Opcode::MemoryRun, 1 + 8 + bytes.size());
+		append(out, address, 8);
+		out.append(bytes);
+		return out;
+	}
+
+	std::string registerSnapshot(const std::vector<std::pair<UByte, Word>> &registers) {
+		std::string out = start(Opcode::RegisterSnapshot, 1 + 1 + 9 * registers.size());
+		append(out, registers.size(), 1);
+		for (const auto &[id, value]: registers) {
+			append(out, id, 1);
+			append(out, value, 8);
+		}
+		return out;
+	}
+
+	UWord readU64(std::string_view buffer, size_t offset) {
+		UWord out = 0;
+		for (size_t i = 0; i < 8; ++i)
+			out |= UWord(UByte(buffer.at(offset + i))) << (8 * i);
+		return out;
+	}
+
+	UHWord readU32(std::string_view buffer, size_t offset) {
+		UHWord out = 0;
+		for (size_t i = 0; i < 4; ++i)
+			out |= UHWord(UByte(buffer.at(offset + i))) << (8 * i);
+		return out;
+	}
+
+	UByte readU8(std::string_view buffer, size_t offset) {
+		return UByte(buffer.at(offset));
+	}
+}
@@ -1,6 +1,7 @@
 // Based in large part on example code from the GNU libc documentation.
 
 #include <iostream>
+#include <vector>
 
 #include <arpa/inet.h>
 #include <errno.h>
@@ -8,9 +9,13 @@
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "net/Binary.h"
 #include "net/NetError.h"
 #include "net/Server.h"
 
@@ -37,32 +42,47 @@ namespace WVM::Net {
 	}
 
 	void Server::readFromClient(int descriptor) {
-		std::string &str = buffers[descriptor];
-		str.reserve(chunkSize);
+		// Descriptors are edge-triggered, so everything that's available has to be read now.
+		for (;;) {
+			const ssize_t byte_count = ::read(descriptor, buffer, chunkSize);
+			if (byte_count < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return;
+				throw NetError("Reading", errno);
+			}
 
-		int byte_count = ::read(descriptor, buffer, chunkSize);
-		if (byte_count < 0) {
-			throw NetError("Reading", errno);
-		} else if (byte_count == 0) {
-			end(descriptor);
-		} else if (!lineMode) {
-			handleMessage(clients.at(descriptor), str);
-			buffers[descriptor].clear();
-		} else {
-			str.insert(str.size(), buffer, byte_count);
-			ssize_t index;
-			size_t delimiter_size;
-			bool done = false;
-			std::tie(index, delimiter_size) = isMessageComplete(str);
-			do {
-				if (index != -1) {
-					handleMessage(clients.at(descriptor), str.substr(0, index));
-					if (clients.count(descriptor) == 1) {
-						str.erase(0, index + delimiter_size);
-						std::tie(index, delimiter_size) = isMessageComplete(str);
-					} else done = true;
-				} else done = true;
-			} while (!done);
+			if (byte_count == 0) {
+				end(descriptor);
+				return;
+			}
+
+			const int client = clients.at(descriptor);
+			if (!lineMode) {
+				handleMessage(client, std::string(buffer, byte_count));
+				if (clients.count(descriptor) == 0)
+					return;
+				continue;
+			}
+
+			std::string &str = buffers[descriptor];
+			str.append(buffer, byte_count);
+
+			// Consumed messages are erased all at once afterwards instead of shifting the buffer after each one.
+			size_t offset = 0;
+			for (;;) {
+				const auto [index, delimiter_size] = isMessageComplete(std::string_view(str).substr(offset));
+				if (index == -1)
+					break;
+				handleMessage(client, str.substr(offset, index));
+				// Handling the message may have disconnected the client, which destroys its buffer.
+				if (clients.count(descriptor) == 0)
+					return;
+				offset += index + delimiter_size;
+			}
+
+			str.erase(0, offset);
 		}
 	}
 
@@ -75,89 +95,377 @@ namespace WVM::Net {
 	}
 
 	void Server::end(int descriptor) {
-		::close(descriptor);
-		const int client = clients.at(descriptor);
-		descriptors.erase(client);
-		buffers.erase(descriptor);
-		clients.erase(descriptor);
-		allClients.erase(client);
-		FD_CLR(descriptor, &activeSet);
+		int client;
+		{
+			auto lock = lockOutput();
+			auto iter = outputs.find(descriptor);
+			if (iter != outputs.end()) {
+				// A client removed by the server should still receive whatever was sent to it last.
+				iter->second.blocked = false;
+				flush(descriptor, iter->second);
+				outputs.erase(iter);
+			}
+			::close(descriptor);
+			client = clients.at(descriptor);
+			descriptors.erase(client);
+			buffers.erase(descriptor);
+			binaryDescriptors.erase(descriptor);
+			clients.erase(descriptor);
+			allClients.erase(client);
+		}
+		// Closing the descriptor also removed it from the epoll set.
 		if (onEnd)
 			onEnd(client, descriptor);
 	}
 
-	void Server::send(int client, const std::string &message, bool suppress_newline) {
-		::write(descriptors.at(client), message.c_str(), message.size());
-		if (!suppress_newline)
-			::write(descriptors.at(client), "\n", 1);
+	void Server::send(int client, const std::string &message, bool suppress_newline, Stream stream) {
+		auto lock = lockOutput();
+		auto iter = descriptors.find(client);
+		// Another thread may still be sending events to a client that has just been removed.
+		if (iter == descriptors.end())
+			return;
+		const int descriptor = iter->second;
+		if (binaryDescriptors.count(descriptor) != 0)
+			enqueue(descriptor, Binary::text(message), 1, stream);
+		else
+			enqueue(descriptor, suppress_newline? std::string(message) : message + '\n', suppress_newline? 1 : 2, stream);
+	}
+
+	void Server::sendFrame(int client, const std::string &frame, Stream stream) {
+		auto lock = lockOutput();
+		auto iter = descriptors.find(client);
+		if (iter != descriptors.end())
+			enqueue(iter->second, std::string(frame), 1, stream);
+	}
+
+	void Server::enqueue(int descriptor, std::string &&data, uint64_t unbuffered_syscalls, Stream stream) {
+		Output &output = outputs[descriptor];
+		if (output.disconnecting)
+			return;
+
+		if (stream != CONTROL && (output.stale[stream] || output.limit < output.bytes + data.size())
+		    && !overflow(descriptor, output, data.size(), stream)) {
+			++stats.dropped;
+			return;
+		}
+
+		output.bytes += data.size();
+		++stats.messages;
+		stats.bytes += data.size();
+		stats.unbufferedSyscalls += unbuffered_syscalls;
+		output.messages.emplace_back(std::move(data), stream);
+
+		if (flushThreshold <= output.bytes)
+			flush(descriptor, output);
+		else
+			requestFlush();
+	}
+
+	bool Server::overflow(int descriptor, Output &output, size_t size, Stream stream) {
+		if (output.stale[stream])
+			return false;
+
+		switch (output.overflow[stream]) {
+			case Overflow::DropOldest:
+				// The first message may be partially written already, so it has to stay.
+				for (auto iter = output.messages.begin() + (output.offset == 0? 0 : 1);
+				     iter != output.messages.end() && output.limit < output.bytes + size;) {
+					if (iter->stream == stream) {
+						output.bytes -= iter->data.size();
+						++stats.dropped;
+						iter = output.messages.erase(iter);
+					} else {
+						++iter;
+					}
+				}
+				return output.bytes + size <= output.limit;
+
+			case Overflow::Coalesce:
+				output.stale.set(stream);
+				if (onOverflow)
+					onOverflow(clients.at(descriptor), stream);
+				return false;
+
+			case Overflow::Disconnect:
+				output.disconnecting = true;
+				requestFlush();
+				return false;
+		}
+
+		return false;
+	}
+
+	void Server::requestFlush() {
+		if (connected && std::this_thread::get_id() != loopThread && !flushRequested.exchange(true)) {
+			// The event loop flushes everything once it wakes up.
+			const ControlMessage control = ControlMessage::Flush;
+			::write(controlWrite, &control, 1);
+		}
+	}
+
+	void Server::wake() {
+		if (connected) {
+			const ControlMessage control = ControlMessage::Flush;
+			::write(controlWrite, &control, 1);
+		}
+	}
+
+	void Server::setQueueLimit(int client, size_t limit) {
+		auto lock = lockOutput();
+		outputs[descriptors.at(client)].limit = limit;
+	}
+
+	void Server::setOverflow(int client, Stream stream, Overflow overflow) {
+		auto lock = lockOutput();
+		outputs[descriptors.at(client)].overflow.at(stream) = overflow;
+	}
+
+	void Server::handleBackpressure() {
+		std::vector<int> disconnecting;
+		std::vector<std::pair<int, Stream>> resuming;
+		{
+			auto lock = lockOutput();
+			for (auto &[descriptor, output]: outputs) {
+				if (output.disconnecting) {
+					disconnecting.push_back(descriptor);
+				} else if (output.stale.any() && output.bytes <= output.limit / 2) {
+					for (Stream stream = 0; stream < MAX_STREAMS; ++stream)
+						if (output.stale[stream])
+							resuming.emplace_back(clients.at(descriptor), stream);
+					output.stale.reset();
+				}
+			}
+		}
+
+		for (const int descriptor: disconnecting) {
+			std::cerr << "Server: disconnecting client " << clients.at(descriptor) << " because its queue is full\n";
+			end(descriptor);
+		}
+
+		if (onResume)
+			for (const auto &[client, stream]: resuming)
+				if (descriptors.count(client) != 0)
+					onResume(client, stream);
+	}
+
+	void Server::setBinary(int client, bool binary, const std::string &acknowledgement) {
+		auto lock = lockOutput();
+		const int descriptor = descriptors.at(client);
+		if (!acknowledgement.empty())
+			send(client, acknowledgement);
+		if (binary)
+			binaryDescriptors.insert(descriptor);
+		else
+			binaryDescriptors.erase(descriptor);
+	}
+
+	bool Server::isBinary(int client) {
+		auto lock = lockOutput();
+		auto iter = descriptors.find(client);
+		return iter != descriptors.end() && binaryDescriptors.count(iter->second) != 0;
+	}
+
+	bool Server::flush(int descriptor, Output &output) {
+		static constexpr size_t MAX_IOVECS = 64;
+		if (output.blocked)
+			return output.messages.empty();
+		while (!output.messages.empty()) {
+			iovec iovecs[MAX_IOVECS];
+			size_t count = 0;
+			for (auto iter = output.messages.begin(); iter != output.messages.end() && count < MAX_IOVECS; ++iter) {
+				const size_t skip = count == 0? output.offset : 0;
+				iovecs[count].iov_base = iter->data.data() + skip;
+				iovecs[count++].iov_len = iter->data.size() - skip;
+			}
+
+			// sendmsg is writev with flags; MSG_NOSIGNAL keeps a vanished client from raising SIGPIPE.
+			msghdr header {};
+			header.msg_iov = iovecs;
+			header.msg_iovlen = count;
+			const ssize_t written = ::sendmsg(descriptor, &header, MSG_NOSIGNAL);
+			++stats.syscalls;
+
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					output.blocked = true;
+					return false;
+				}
+				// The connection is broken. Reading from it will fail or return EOF, which ends the client.
+				output.messages.clear();
+				output.offset = output.bytes = 0;
+				return true;
+			}
+
+			output.bytes -= written;
+			for (size_t remaining = written; 0 < remaining;) {
+				const size_t left = output.messages.front().data.size() - output.offset;
+				if (remaining < left) {
+					output.offset += remaining;
+					break;
+				}
+				remaining -= left;
+				output.messages.pop_front();
+				output.offset = 0;
+			}
+		}
+
+		return true;
+	}
+
+	void Server::flushAll() {
+		auto lock = lockOutput();
+		flushRequested = false;
+		// Blocked clients wait for EPOLLOUT instead of costing a failed write on every iteration.
+		for (auto &[descriptor, output]: outputs)
+			if (!output.messages.empty() && !output.blocked)
+				flush(descriptor, output);
+	}
+
+	Server::Stats Server::getStats() {
+		auto lock = lockOutput();
+		return stats;
+	}
+
+	std::set<int> Server::getClients() {
+		auto lock = lockOutput();
+		return allClients;
 	}
 
 	void Server::removeClient(int client) {
 		end(descriptors.at(client));
 	}
 
-	void Server::run() {
-		struct sockaddr_in clientname;
-		size_t size;
+	void Server::acceptClients() {
+		for (;;) {
+			sockaddr_in name;
+			socklen_t size = sizeof(name);
+			const int new_fd = ::accept4(sock, (sockaddr *) &name, &size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (new_fd < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return;
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				throw NetError("accept()", errno);
+			}
+
+			std::cerr << "Server: connect from host " << inet_ntoa(name.sin_addr) << ", port " << ntohs(name.sin_port)
+			          << "\n";
 
+			epoll_event event {};
+			event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+			event.data.fd = new_fd;
+			if (::epoll_ctl(epollFD, EPOLL_CTL_ADD, new_fd, &event) < 0)
+				throw NetError("epoll_ctl()", errno);
+
+			auto lock = lockOutput();
+			int new_client = ++lastClient;
+			Output &output = outputs[new_fd];
+			output.limit = queueLimit;
+			output.overflow = defaultOverflow;
+			descriptors.emplace(new_client, new_fd);
+			clients.erase(new_fd);
+			clients.emplace(new_fd, new_client);
+			allClients.insert(new_client);
+		}
+	}
+
+	bool Server::readControl() {
+		char messages[64];
+		for (;;) {
+			const ssize_t count = ::read(controlRead, messages, sizeof(messages));
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count < 0)
+				return !(errno == EAGAIN || errno == EWOULDBLOCK);
+			if (count == 0 || std::string_view(messages, count).find(char(ControlMessage::Close)) != std::string_view::npos)
+				return true;
+		}
+	}
+
+	void Server::run() {
 		int control_pipe[2];
-		if (pipe(control_pipe) < 0)
+		if (::pipe2(control_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
 			throw NetError("pipe()", errno);
 
 		controlRead  = control_pipe[0];
 		controlWrite = control_pipe[1];
 
 		sock = makeSocket();
-		if (::listen(sock, 1) < 0)
+		if (::fcntl(sock, F_SETFL, ::fcntl(sock, F_GETFL) | O_NONBLOCK) < 0)
+			throw NetError("fcntl()", errno);
+		if (::listen(sock, SOMAXCONN) < 0)
 			throw NetError("Listening", errno);
 
-		FD_ZERO(&activeSet);
-		FD_SET(sock, &activeSet);
-		FD_SET(controlRead, &activeSet);
+		epollFD = ::epoll_create1(EPOLL_CLOEXEC);
+		if (epollFD < 0)
+			throw NetError("epoll_create1()", errno);
+
+		for (const int descriptor: {sock, controlRead}) {
+			epoll_event event {};
+			event.events = EPOLLIN | EPOLLET;
+			event.data.fd = descriptor;
+			if (::epoll_ctl(epollFD, EPOLL_CTL_ADD, descriptor, &event) < 0)
+				throw NetError("epoll_ctl()", errno);
+		}
+
+		loopThread = std::this_thread::get_id();
 		connected = true;
 
-		fd_set read_set;
+		epoll_event events[MAX_EVENTS];
 		for (;;) {
-			// Block until input arrives on one or more active sockets.
-			read_set = activeSet;
-			if (::select(FD_SETSIZE, &read_set, NULL, NULL, NULL) < 0)
-				throw NetError("select()", errno);
-
-			if (FD_ISSET(controlRead, &read_set)) {
-				std::cerr << "Closed server socket.\n";
-				::close(sock);
-				break;
+			const int count = ::epoll_wait(epollFD, events, MAX_EVENTS, -1);
+			if (count < 0) {
+				if (errno == EINTR)
+					continue;
+				throw NetError("epoll_wait()", errno);
 			}
 
-			// Service all the sockets with input pending.
-			for (int i = 0; i < FD_SETSIZE; ++i) {
-				if (FD_ISSET(i, &read_set)) {
-					if (i == sock) {
-						// Connection request on original socket.
-						int new_fd;
-						size = sizeof(clientname);
-						new_fd = ::accept(sock, (sockaddr *) &clientname, (socklen_t *) &size);
-						if (new_fd < 0)
-							throw NetError("accept()", errno);
-						std::cerr << "Server: connect from host " << inet_ntoa(clientname.sin_addr) << ", port "
-						          << ntohs(clientname.sin_port) << "\n";
-						FD_SET(new_fd, &activeSet);
-						int new_client = ++lastClient;
-						descriptors.emplace(new_client, new_fd);
-						clients.erase(new_fd);
-						clients.emplace(new_fd, new_client);
-						allClients.insert(new_client);
-					} else if (i != controlRead) {
-						// Data arriving on an already-connected socket.
-						try {
-							readFromClient(i);
-						} catch (const NetError &err) {
-							std::cerr << err.what() << "\n";
-							removeClient(clients.at(i));
+			bool closing = false;
+			for (int i = 0; i < count; ++i) {
+				const int descriptor = events[i].data.fd;
+				const uint32_t flags = events[i].events;
+				if (descriptor == controlRead) {
+					closing = readControl() || closing;
+				} else if (descriptor == sock) {
+					acceptClients();
+				} else if (clients.count(descriptor) != 0) {
+					try {
+						if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+							readFromClient(descriptor);
+					} catch (const NetError &err) {
+						std::cerr << err.what() << "\n";
+						removeClient(clients.at(descriptor));
+					}
+
+					// A client whose socket was full has room for the rest of its output again.
+					if ((flags & EPOLLOUT) && clients.count(descriptor) != 0) {
+						auto lock = lockOutput();
+						auto iter = outputs.find(descriptor);
+						if (iter != outputs.end()) {
+							iter->second.blocked = false;
+							flush(descriptor, iter->second);
 						}
 					}
 				}
 			}
+
+			if (onLoop)
+				onLoop();
+
+			// Everything sent while handling this iteration's events (or by other threads since the last flush) goes
+			// out now.
+			flushAll();
+			handleBackpressure();
+
+			if (closing) {
+				std::cerr << "Closed server socket.\n";
+				::close(sock);
+				::close(epollFD);
+				epollFD = -1;
+				break;
+			}
 		}
 	}
 
@@ -169,8 +477,8 @@ namespace WVM::Net {
 		}
 	}
 
-	std::pair<ssize_t, size_t> Server::isMessageComplete(const std::string &buf) {
+	std::pair<ssize_t, size_t> Server::isMessageComplete(std::string_view buf) {
 		const size_t found = buf.find("\n");
-		return found == std::string::npos? std::pair<ssize_t, size_t>(-1, 0) : std::pair<ssize_t, size_t>(found, 1);
+		return found == std::string_view::npos? std::pair<ssize_t, size_t>(-1, 0) : std::pair<ssize_t, size_t>(found, 1);
 	}
 }
@@ -0,0 +1,163 @@
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "net/NetError.h"
+#include "net/Shared.h"
+
+namespace WVM::Net {
+	std::unique_ptr<SharedState> SharedState::create(size_t ring_capacity) {
+		size_t capacity = 1;
+		while (capacity < ring_capacity)
+			capacity <<= 1;
+
+		std::unique_ptr<SharedState> out(new SharedState);
+		out->descriptor = ::memfd_create("wvm-state", MFD_CLOEXEC);
+		if (out->descriptor == -1)
+			throw NetError("memfd_create()", errno);
+		out->length = sizeof(Header) + capacity * sizeof(Slot);
+		if (::ftruncate(out->descriptor, out->length) == -1)
+			throw NetError("ftruncate()", errno);
+		out->map(true);
+
+		// The new file is all zeros, which is already a valid initial state for the slots.
+		new (out->header) Header {};
+		out->header->magic = MAGIC;
+		out->header->version = VERSION;
+		out->header->capacity = capacity;
+		return out;
+	}
+
+	std::unique_ptr<SharedState> SharedState::view(int descriptor) {
+		struct stat info;
+		if (::fstat(descriptor, &info) == -1)
+			throw NetError("fstat()", errno);
+		if (size_t(info.st_size) < sizeof(Header))
+			throw std::runtime_error("Shared state file is too small");
+
+		std::unique_ptr<SharedState> out(new SharedState);
+		out->descriptor = ::dup(descriptor);
+		if (out->descriptor == -1)
+			throw NetError("dup()", errno);
+		out->length = info.st_size;
+		out->map(false);
+
+		if (out->header->magic != MAGIC || out->header->version != VERSION)
+			throw std::runtime_error("Not a shared state file of version " + std::to_string(VERSION));
+		if (out->length < sizeof(Header) + out->header->capacity * sizeof(Slot))
+			throw std::runtime_error("Shared state file is truncated");
+		return out;
+	}
+
+	SharedState::~SharedState() {
+		if (header != nullptr)
+			::munmap(header, length);
+		if (descriptor != -1)
+			::close(descriptor);
+	}
+
+	void SharedState::map(bool writable) {
+		void *mapped = ::mmap(nullptr, length, writable? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, descriptor,
+			0);
+		if (mapped == MAP_FAILED)
+			throw NetError("mmap()", errno);
+		header = static_cast<Header *>(mapped);
+		slots = reinterpret_cast<Slot *>(header + 1);
+	}
+
+	void SharedState::setRegister(UByte id, Word value) {
+		std::unique_lock lock(writeMutex);
+		beginSnapshot();
+		header->registers[id].store(value, std::memory_order_relaxed);
+		endSnapshot();
+		push(EventType::Register, id, value);
+	}
+
+	void SharedState::setPC(Word pc) {
+		std::unique_lock lock(writeMutex);
+		beginSnapshot();
+		header->programCounter.store(pc, std::memory_order_relaxed);
+		endSnapshot();
+		push(EventType::PC, 0, pc);
+	}
+
+	void SharedState::setMemorySize(size_t size) {
+		header->memorySize.store(size, std::memory_order_release);
+	}
+
+	void SharedState::memoryChanged(Word address, size_t count) {
+		std::unique_lock lock(writeMutex);
+		push(EventType::Memory, count, address);
+	}
+
+	void SharedState::beginSnapshot() {
+		header->sequence.store(header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void SharedState::endSnapshot() {
+		header->sequence.store(header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void SharedState::push(EventType type, uint32_t argument, Word value) {
+		const uint64_t index = header->written.load(std::memory_order_relaxed);
+		Slot &slot = slots[index & (header->capacity - 1)];
+		slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.kind.store(uint64_t(type) << 32 | argument, std::memory_order_relaxed);
+		slot.value.store(value, std::memory_order_relaxed);
+		slot.sequence.store(2 * index + 2, std::memory_order_release);
+		header->written.store(index + 1, std::memory_order_release);
+	}
+
+	void SharedState::readSnapshot(Word *registers, Word &pc) const {
+		for (;;) {
+			const uint64_t before = header->sequence.load(std::memory_order_acquire);
+			if (before % 2 == 0) {
+				for (int id = 0; id < Why::totalRegisters; ++id)
+					registers[id] = header->registers[id].load(std::memory_order_relaxed);
+				pc = header->programCounter.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (header->sequence.load(std::memory_order_relaxed) == before)
+					return;
+			}
+		}
+	}
+
+	SharedState::Status SharedState::next(UWord &cursor, Event &event) const {
+		const uint64_t written = header->written.load(std::memory_order_acquire);
+		if (written <= cursor)
+			return Status::Empty;
+
+		if (header->capacity < written - cursor) {
+			cursor = written;
+			return Status::Lost;
+		}
+
+		const Slot &slot = slots[cursor & (header->capacity - 1)];
+		const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+		const uint64_t kind = slot.kind.load(std::memory_order_relaxed);
+		event.value = slot.value.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// The writer may have lapped the reader while it was reading.
+		if (sequence != 2 * cursor + 2 || slot.sequence.load(std::memory_order_relaxed) != sequence) {
+			cursor = header->written.load(std::memory_order_acquire);
+			return Status::Lost;
+		}
+
+		event.type = EventType(kind >> 32);
+		event.argument = kind & 0xffffffff;
+		++cursor;
+		return Status::Event;
+	}
+
+	UWord SharedState::getCursor() const {
+		return header->written.load(std::memory_order_acquire);
+	}
+
+	size_t SharedState::getMemorySize() const {
+		return header->memorySize.load(std::memory_order_acquire);
+	}
+}